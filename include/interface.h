@@ -1,12 +1,28 @@
 #pragma once
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define kCellsPerWord 64
 
 const char* get_version();
 
+/* Cells are bit-packed column-major: column x is `words` consecutive
+ * 64-bit words, bit (y % 64) of word (y / 64) holds cell (x, y).
+ *
+ * Every column is surrounded by a ghost word above and below, and the board
+ * by ghost columns x = -1 and x = width, which hold copies of the opposite
+ * torus edge (see refresh_halo). Row y = -1 is bit 63 of column[-1], row
+ * y = height is the first bit after the last data row, which can be inside
+ * the last data word. Consecutive columns are `stride` words apart. */
 typedef struct {
     int width, height;
-    bool* buffer;
+    int words, stride;
+    uint64_t* storage;
+    uint64_t* buffer;
 } field_t;
 
 struct workers_internal;
@@ -15,20 +31,209 @@ typedef struct {
     struct workers_internal* impl;
 } workers_t;
 
-static inline bool* get_cell(field_t* field, int x, int y) {
-    return field->buffer + x * field->height + y;
+static inline uint64_t* get_column(const field_t* field, int x) {
+    return field->buffer + (long)x * field->stride;
+}
+
+/* Number of words spanned by columns [from_x, to_x], ghost words in between
+ * included. */
+static inline int get_columns_span(const field_t* field, int from_x, int to_x) {
+    return (to_x - from_x) * field->stride + field->words;
+}
+
+/* Bits of the last data word of a column that hold real cells. */
+static inline uint64_t get_tail_mask(const field_t* field) {
+    return ~(uint64_t)0 >> (kCellsPerWord - 1 - (field->height - 1) % kCellsPerWord);
+}
+
+static inline bool get_cell(const field_t* field, int x, int y) {
+    return (get_column(field, x)[y / kCellsPerWord] >> (y % kCellsPerWord)) & 1;
+}
+
+static inline void set_cell(field_t* field, int x, int y, bool alive) {
+    uint64_t* word = get_column(field, x) + y / kCellsPerWord;
+    uint64_t mask = (uint64_t)1 << (y % kCellsPerWord);
+    *word = alive ? (*word | mask) : (*word & ~mask);
+}
+
+/* Life-like rule: a dead cell with n live neighbors is born if bit n of
+ * `birth` is set, a live one survives if bit n of `survive` is. */
+typedef struct {
+    uint16_t birth, survive;
+} rule_t;
+
+#define kConwayRule ((rule_t){1 << 3, 1 << 2 | 1 << 3})
+/* Long enough for `B012345678/S012345678`. */
+#define kMaxRuleLength 24
+
+static inline bool get_next_state(rule_t rule, bool alive, int neighbors) {
+    return ((alive ? rule.survive : rule.birth) >> neighbors) & 1;
 }
 
-const char* setup_field(int argc, char* argv[], field_t* field);
+/* `B3/S23`, `B3S23` or the older survival-first `23/3`. */
+bool parse_rulestring(const char* text, size_t length, rule_t* rule);
+void format_rule(rule_t rule, char buffer[kMaxRuleLength]);
+
+typedef enum {
+    kScheduleSteal,
+    kScheduleWavefront,
+} schedule_t;
+
+#define kBenchBoardSide 1024
+
+typedef enum {
+    kBenchNone,
+    kBenchSoup,
+    kBenchGliders,
+    kBenchOscillators,
+} bench_t;
+
+/* Command line settings shared by all backends. */
+typedef struct {
+    const char* config_path;
+    int tile_width, tile_rows;  /* -1 - sized automatically, 0 - no tiling */
+    int time_block;
+    bool track_activity;
+    int node_cache;
+    int threads;                /* 0 - one per online CPU */
+    schedule_t schedule;
+    int halo_depth;             /* -1 - picked by a benchmark at startup */
+    bool run_length_transfers;
+    int board_width, board_height;  /* 0 - just large enough for the pattern */
+    int offset_x, offset_y;
+    bench_t bench;
+    int bench_generations;      /* 0 - picked from the board size */
+    double density;
+    const char* trace_path;     /* NULL - no trace */
+    rule_t rule;
+    bool rule_given;            /* --rule wins over the rule of a pattern */
+    int max_period;
+} options_t;
+
+extern options_t options;
+
+const char* parse_options(int argc, char* argv[]);
+void print_options_help();
+
+const char* setup_field(const char* filename, field_t* field);
 void init_field(field_t* field, int width, int height);
 void destroy_field(field_t* field);
+/* Both fields are of the same size; ghost cells are copied too. */
+void copy_field(field_t* to, const field_t* from);
+void print_field(const field_t* field, long long generation);
+
+/* Sets up a board for an RLE or plaintext (.cells) pattern, sized by
+ * --board and placed at --offset. */
+const char* load_pattern(const char* filename, field_t* field);
+/* Fills a --board sized board with the --bench workload. */
+const char* setup_bench_field(field_t* field);
+
+/* Binary snapshot: this header, then the board's columns one after another,
+ * `words` words each with the ghost words left out. The header keeps the
+ * words 64-byte aligned, so a mapped file can be copied from directly. */
+#define kSnapshotMagic "LIFESNAP"
+#define kSnapshotVersion 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    int64_t width, height;
+    int64_t generation;
+    uint8_t reserved[24];
+} snapshot_header_t;
+
+#define kMaxPathLength 4096
+
+/* Reads the file name argument of `save` and `load`; false, and a message
+ * printed, if there is none. */
+bool scan_path(char path[kMaxPathLength]);
+
+void make_snapshot_header(snapshot_header_t* header, const field_t* field, long long generation);
+/* Whether a snapshot of `file_size` bytes with this header fits `field`. */
+const char* check_snapshot_header(const snapshot_header_t* header, const field_t* field,
+                                  size_t file_size);
+const char* save_snapshot(const char* filename, const field_t* field, long long generation);
+/* `field` must be as large as the snapshot; `generation` may be NULL. */
+const char* load_snapshot(const char* filename, field_t* field, long long* generation);
+
+/* Copies the board the workers last published to `snapshot` without
+ * holding `mtx` for the copy. The board, its generation and the shift shown
+ * to the user are read under the lock, and whoever swaps or overwrites the
+ * board bumps `epoch` under it, so the copy is good if the epoch stayed the
+ * same. Sets `*gen` to the generation shown to the user; returns false if
+ * every try was cut short, then the caller copies under the lock. */
+bool copy_published_field(field_t* snapshot, field_t* const* field, const int* generation,
+                          const int* gen_shift, atomic_int* epoch, pthread_mutex_t* mtx,
+                          int* gen);
+
+/* Counters behind `stats` and --trace, kept since the start. Times are in
+ * nanoseconds and summed over the `workers` threads or ranks that compute:
+ * busy advancing cells, waiting for one another while generations are due,
+ * and idle while none are. Passes are the steps the generations are
+ * computed in; dumps and saves count the time they took to get a board. */
+typedef struct {
+    long long generation;
+    int workers;
+    long long passes;
+    long long pass_ns, max_pass_ns;
+    long long busy_ns, wait_ns, idle_ns;
+    long long snapshots, snapshot_ns;
+    long long messages, bytes;  /* sent by MPI ranks to one another */
+} stats_t;
+
+/* `run-until-stable`: hashes of the boards of the last options.max_period
+ * generations, the latest at `next` - 1. */
+typedef struct {
+    uint64_t* hashes;
+    int count, next;
+} cycle_detector_t;
+
+/* Where a `run-until-stable` is: asked for by the command, or hashing the
+ * boards the workers compute until one repeats or the run ends, `stop`
+ * included. Whoever computes the generations then prints the outcome. */
+typedef enum {
+    kStableOff,
+    kStableRequested,
+    kStableDetecting,
+} stable_state_t;
+
+void init_cycle_detector(cycle_detector_t* detector);
+void destroy_cycle_detector(cycle_detector_t* detector);
+/* Takes the hash of the next generation's board. Returns the period if it
+ * is the hash of one of the last options.max_period boards, 0 otherwise. */
+int detect_cycle(cycle_detector_t* detector, uint64_t hash);
+
+/* Read the generation count of `run` and the optional limit of
+ * `run-until-stable`, 0 if there is none. False, and a message printed, if
+ * it is not a positive number. */
+bool scan_count(int* generations);
+bool scan_limit(int* generations);
+/* The outcome of `run-until-stable` stopped at `generation`; period 0 if
+ * no cycle turned up. Flushed, as it comes in between commands. */
+void print_cycle(long long generation, int period);
+
+long long get_time_ns();
+void print_stats(const stats_t* stats);
+/* --trace: a CSV line is due at most once a second. */
+bool is_trace_due();
+void write_trace(const stats_t* stats);
 
 const char* setup_workers(field_t* field, workers_t* workers);
 void destroy_workers(workers_t* workers);
 
 void dump_field(field_t*, workers_t*);
+void dump_stats(field_t*, workers_t*);
+void save_field(field_t*, workers_t*);
+void load_field(field_t*, workers_t*);
 void run       (field_t*, workers_t*);
+void run_until_stable(field_t*, workers_t*);
 void stop      (field_t*, workers_t*);
 
+/* Asks for n more generations, as `run` does. */
+void run_generations(workers_t*, int n);
+/* Returns once every generation asked for so far is computed. */
+void finish_generations(workers_t*);
+
 void run_controller_loop(field_t*, workers_t*);
 void stop_emulation(workers_t*);
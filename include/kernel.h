@@ -0,0 +1,121 @@
+#pragma once
+
+#include <interface.h>
+
+/* Picks the widest SIMD kernel the host CPU supports. The choice can be
+ * overridden with GAME_KERNEL=avx512|avx2|sse2|scalar. */
+const char* setup_kernel();
+const char* get_kernel_name();
+
+/* Switches the kernels to options.rule. B3/S23 has kernels of its own, any
+ * other rule goes through a table of outcomes by neighbor count. */
+void setup_rule();
+
+/* Computes columns [from_x, to_x] of `next_field` from `field`. Whole 64-cell
+ * words are evaluated at once. Neighbors outside the board are read from the
+ * ghost cells of `field`, which must be up to date; the ghost cells of
+ * `next_field` are left for the caller to refresh. */
+void step_columns(const field_t* field, field_t* next_field, int from_x, int to_x);
+
+/* Same as step_columns, restricted to words [from_w, to_w] of each column. */
+void step_block(const field_t* field, field_t* next_field, int from_x, int to_x,
+                int from_w, int to_w);
+
+/* Torus wrap of the ghost cells: rows -1 and `height` of columns
+ * [from_x, to_x], and ghost columns -1 and `width` as copies of the opposite
+ * edge. The latter copies whole columns, so it goes after the former. */
+void refresh_vertical_halo(field_t* field, int from_x, int to_x);
+void refresh_horizontal_halo(field_t* field);
+void refresh_halo(field_t* field);
+
+/* Cache blocking: the board is walked in a grid of `columns` x `rows` tiles
+ * of `width` columns by `words` 64-row words (the last tile of a row or a
+ * column also takes the remainder), and each tile may be advanced `depth`
+ * generations at a time out of a per-thread scratch buffer before it is
+ * written back. */
+typedef struct {
+    int width, words;
+    int depth;
+    int columns, rows;
+    int board_width, board_words;
+} tiling_t;
+
+typedef struct {
+    field_t buffers[2];
+} tile_scratch_t;
+
+/* Which tiles changed during the last pass. A tile is recomputed only if it
+ * or one of its eight neighbors did; otherwise `next_field` already holds
+ * its next state, since the tile has not changed since the generation that
+ * buffer keeps. This stays true for passes of `depth` generations as long
+ * as a tile is at least `depth` cells across and every pass is as deep as
+ * the one that produced the flags, or the flags come from a single
+ * generation (a still region stays still). */
+typedef struct {
+    uint8_t* changed;
+    uint8_t* next_changed;
+    int flags_depth, pass_depth;
+    bool all_active;
+    /* Hash of every tile, see start_hashing. */
+    uint64_t* hashes;
+    bool hashing;
+} activity_t;
+
+/* Resolves --tile/--time-block/--activity against the board size. */
+tiling_t make_tiling(const field_t* field);
+
+static inline int get_tile_from_x(const tiling_t* tiling, int column) {
+    return column * tiling->width;
+}
+
+static inline int get_tile_to_x(const tiling_t* tiling, int column) {
+    return column == tiling->columns - 1 ? tiling->board_width - 1
+                                         : (column + 1) * tiling->width - 1;
+}
+
+void init_tile_scratch(tile_scratch_t* scratch, const tiling_t* tiling);
+void destroy_tile_scratch(tile_scratch_t* scratch);
+
+void init_activity(activity_t* activity, const tiling_t* tiling);
+void destroy_activity(activity_t* activity);
+/* Marks every tile changed, as init_activity does, once the board has been
+ * replaced behind the flags' back. */
+void reset_activity(activity_t* activity, const tiling_t* tiling);
+
+/* Keeps a hash of the board for get_board_hash: every tile of `field` is
+ * hashed now, and then passes rehash the tiles they change. Marks every
+ * tile changed, as the flags are not kept up to date without --activity. */
+void start_hashing(activity_t* activity, const tiling_t* tiling, const field_t* field);
+void stop_hashing(activity_t* activity);
+uint64_t get_board_hash(const activity_t* activity, const tiling_t* tiling);
+
+/* Passes record flags while either is on. */
+static inline activity_t* get_pass_activity(activity_t* activity) {
+    return options.track_activity || activity->hashing ? activity : NULL;
+}
+
+/* Hash of words [from_w, to_w] of columns [from_x, to_x], the last word
+ * cut to `last_mask`, as the part of the board at (x + dx, w + dw) of a
+ * board `board_words` words tall. The hash of a board is the sum of hashes
+ * of any of its partitions. */
+uint64_t hash_block(const field_t* field, int from_x, int to_x, int from_w, int to_w,
+                    uint64_t last_mask, int dx, int dw, int board_words);
+
+/* Called once before and once after every pass, while no worker runs. */
+void begin_activity_pass(activity_t* activity, int depth);
+void finish_activity_pass(activity_t* activity);
+
+/* Writes the tile at tile column `column`, tile row `row` of generation
+ * +`depth` into `next_field`, as step_tiles does for every tile. */
+void step_tile(const field_t* field, field_t* next_field, const tiling_t* tiling,
+               int column, int row, int depth, tile_scratch_t* scratch,
+               activity_t* activity);
+
+/* Writes tile columns [from_column, to_column] of generation +`depth` into
+ * `next_field`; `depth` must not exceed tiling->depth. Ghost cells as in
+ * step_columns. With a non-NULL `activity` unchanged regions are skipped,
+ * the tiles' flags for this pass are recorded and, if it is hashing, the
+ * changed tiles are rehashed. */
+void step_tiles(const field_t* field, field_t* next_field, const tiling_t* tiling,
+                int from_column, int to_column, int depth, tile_scratch_t* scratch,
+                activity_t* activity);
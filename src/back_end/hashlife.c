@@ -0,0 +1,705 @@
+#include <interface.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* HashLife: the board is a quadtree of hash-consed nodes, and every node of
+ * level m >= 2 memoizes its center 2^(m-1) x 2^(m-1) square 2^j generations
+ * ahead. Identical regions share nodes, so sparse and periodic patterns are
+ * advanced by huge powers of two at the cost of a few table lookups.
+ *
+ * The board is a torus. For power-of-two sides it is periodic with period
+ * L = max(width, height), and a node made of four copies of the L x L board
+ * describes the infinite plane around it; see advance_root(). */
+
+#define kNoNode (-1)
+#define kMaxLevel 64
+#define kMinCapacity 1024
+/* A pass that takes longer than this shrinks the next jump; see
+ * hashlife_thread(). */
+#define kJumpBudgetNs 20000000LL
+
+typedef int32_t node_id_t;
+
+typedef struct {
+    node_id_t children[4];  /* nw, ne, sw, se */
+    node_id_t result;
+    node_id_t next;         /* hash chain, or free list once collected */
+    int8_t level;
+    int8_t result_log;
+    bool marked;
+} node_t;
+
+enum { kNW, kNE, kSW, kSE };
+
+typedef struct {
+    node_t* nodes;
+    int capacity;
+    int count;
+    node_id_t free_list;
+
+    node_id_t* buckets;
+    int buckets_count;
+
+    node_id_t empty[kMaxLevel];
+} node_pool_t;
+
+struct workers_internal {
+    pthread_t thread;
+    node_pool_t pool;
+    node_id_t root;
+    int level;              /* log2 of the side of `root` */
+    int width, height;
+
+    long long required_gen, current_gen;
+    bool stop_required;
+    /* Owned by the thread: a pass advances at most 2^jump_log generations,
+     * so `stop` and `load` are heard between passes of bounded length. */
+    int jump_log;
+    /* Under mtx_gen. The one thread is busy for the whole of a pass; idle
+     * time is added once the wait that began at idle_since_ns is over. */
+    stats_t stats;
+    long long idle_since_ns;
+    /* run-until-stable, under mtx_gen. Equal boards are the same node, so
+     * the detector is fed root ids, one generation at a time, until the run
+     * ends. */
+    stable_state_t stable_state;
+    int stable_limit;
+    cycle_detector_t detector;
+
+    pthread_mutex_t mtx_gen;
+    pthread_cond_t cv_gen;
+    pthread_mutex_t mtx_pool;
+};
+
+static uint64_t hash_children(node_id_t nw, node_id_t ne, node_id_t sw, node_id_t se) {
+    uint64_t h = (uint32_t)nw;
+    h = h * 0x9E3779B97F4A7C15ULL + (uint32_t)ne;
+    h = h * 0x9E3779B97F4A7C15ULL + (uint32_t)sw;
+    h = h * 0x9E3779B97F4A7C15ULL + (uint32_t)se;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 32);
+}
+
+static void rehash(node_pool_t* pool, int buckets_count) {
+    free(pool->buckets);
+    pool->buckets_count = buckets_count;
+    pool->buckets = malloc(buckets_count * sizeof(node_id_t));
+    for (int i = 0; i < buckets_count; ++i) {
+        pool->buckets[i] = kNoNode;
+    }
+
+    for (node_id_t id = 0; id < pool->capacity; ++id) {
+        node_t* node = &pool->nodes[id];
+        if (node->level <= 0 || !node->marked) {
+            continue;
+        }
+        uint64_t bucket = hash_children(node->children[0], node->children[1],
+                                        node->children[2], node->children[3]) &
+                          (buckets_count - 1);
+        node->next = pool->buckets[bucket];
+        pool->buckets[bucket] = id;
+    }
+}
+
+static node_id_t alloc_node(node_pool_t* pool) {
+    if (pool->free_list == kNoNode) {
+        int old_capacity = pool->capacity;
+        pool->capacity *= 2;
+        pool->nodes = realloc(pool->nodes, pool->capacity * sizeof(node_t));
+        for (node_id_t id = pool->capacity - 1; id >= old_capacity; --id) {
+            pool->nodes[id].level = -1;
+            pool->nodes[id].marked = false;
+            pool->nodes[id].next = pool->free_list;
+            pool->free_list = id;
+        }
+    }
+
+    node_id_t id = pool->free_list;
+    pool->free_list = pool->nodes[id].next;
+    ++pool->count;
+    return id;
+}
+
+static node_id_t find_node(node_pool_t* pool, node_id_t nw, node_id_t ne,
+                           node_id_t sw, node_id_t se) {
+    uint64_t hash = hash_children(nw, ne, sw, se);
+    for (node_id_t id = pool->buckets[hash & (pool->buckets_count - 1)]; id != kNoNode;
+         id = pool->nodes[id].next) {
+        const node_t* node = &pool->nodes[id];
+        if (node->children[0] == nw && node->children[1] == ne &&
+            node->children[2] == sw && node->children[3] == se) {
+            return id;
+        }
+    }
+
+    if (pool->count >= pool->buckets_count) {
+        /* Live nodes are the marked ones, see collect_garbage(). */
+        rehash(pool, pool->buckets_count * 2);
+    }
+
+    node_id_t id = alloc_node(pool);
+    node_t* node = &pool->nodes[id];
+    node->children[0] = nw;
+    node->children[1] = ne;
+    node->children[2] = sw;
+    node->children[3] = se;
+    node->level = pool->nodes[nw].level + 1;
+    node->result = kNoNode;
+    node->result_log = -1;
+    node->marked = true;
+
+    uint64_t bucket = hash & (pool->buckets_count - 1);
+    node->next = pool->buckets[bucket];
+    pool->buckets[bucket] = id;
+    return id;
+}
+
+static void init_pool(node_pool_t* pool) {
+    pool->capacity = kMinCapacity;
+    pool->count = 0;
+    pool->nodes = malloc(pool->capacity * sizeof(node_t));
+    pool->free_list = kNoNode;
+    for (node_id_t id = pool->capacity - 1; id >= 0; --id) {
+        pool->nodes[id].level = -1;
+        pool->nodes[id].marked = false;
+        pool->nodes[id].next = pool->free_list;
+        pool->free_list = id;
+    }
+    pool->buckets = NULL;
+    rehash(pool, kMinCapacity);
+
+    /* Ids 0 and 1 are the dead and the alive cell. */
+    for (int alive = 0; alive < 2; ++alive) {
+        node_id_t id = alloc_node(pool);
+        pool->nodes[id].level = 0;
+        pool->nodes[id].marked = true;
+        pool->nodes[id].result = kNoNode;
+    }
+
+    pool->empty[0] = 0;
+    for (int level = 1; level < kMaxLevel; ++level) {
+        node_id_t e = pool->empty[level - 1];
+        pool->empty[level] = find_node(pool, e, e, e, e);
+    }
+}
+
+static void destroy_pool(node_pool_t* pool) {
+    free(pool->nodes);
+    free(pool->buckets);
+}
+
+static inline node_id_t child(const node_pool_t* pool, node_id_t id, int quadrant) {
+    return pool->nodes[id].children[quadrant];
+}
+
+static void mark(node_pool_t* pool, node_id_t id) {
+    while (id != kNoNode && !pool->nodes[id].marked) {
+        pool->nodes[id].marked = true;
+        if (pool->nodes[id].level == 0) {
+            return;
+        }
+        mark(pool, child(pool, id, kNW));
+        mark(pool, child(pool, id, kNE));
+        mark(pool, child(pool, id, kSW));
+        id = child(pool, id, kSE);
+    }
+}
+
+/* Keeps the nodes reachable from `root`, from the roots in `history` if it
+ * is not NULL, and the canonical empty nodes. Memoized results survive only
+ * if they point to a kept node. */
+static void collect_garbage(node_pool_t* pool, node_id_t root, const cycle_detector_t* history) {
+    for (node_id_t id = 0; id < pool->capacity; ++id) {
+        pool->nodes[id].marked = pool->nodes[id].level == 0;
+    }
+    mark(pool, root);
+    for (int i = 0; history != NULL && i < history->count; ++i) {
+        mark(pool, (node_id_t)history->hashes[i]);
+    }
+    for (int level = 0; level < kMaxLevel; ++level) {
+        mark(pool, pool->empty[level]);
+    }
+
+    pool->free_list = kNoNode;
+    pool->count = 0;
+    for (node_id_t id = pool->capacity - 1; id >= 0; --id) {
+        node_t* node = &pool->nodes[id];
+        if (node->marked) {
+            ++pool->count;
+            if (node->result != kNoNode && !pool->nodes[node->result].marked) {
+                node->result = kNoNode;
+                node->result_log = -1;
+            }
+        } else {
+            node->level = -1;
+            node->next = pool->free_list;
+            pool->free_list = id;
+        }
+    }
+
+    int buckets_count = kMinCapacity;
+    while (buckets_count < pool->count) {
+        buckets_count *= 2;
+    }
+    rehash(pool, buckets_count);
+}
+
+static node_id_t centered(node_pool_t* pool, node_id_t id) {
+    return find_node(pool, child(pool, child(pool, id, kNW), kSE),
+                     child(pool, child(pool, id, kNE), kSW),
+                     child(pool, child(pool, id, kSW), kNE),
+                     child(pool, child(pool, id, kSE), kNW));
+}
+
+/* One generation of the 4x4 square, returns its 2x2 center. */
+static node_id_t step_level2(node_pool_t* pool, node_id_t id) {
+    int cells[4][4];
+    for (int q = 0; q < 4; ++q) {
+        node_id_t quadrant = child(pool, id, q);
+        for (int c = 0; c < 4; ++c) {
+            cells[(q / 2) * 2 + c / 2][(q % 2) * 2 + c % 2] = child(pool, quadrant, c);
+        }
+    }
+
+    node_id_t next[4];
+    for (int c = 0; c < 4; ++c) {
+        int y = 1 + c / 2, x = 1 + c % 2;
+        int alive_neighbors = 0;
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                if (dx != 0 || dy != 0) {
+                    alive_neighbors += cells[y + dy][x + dx];
+                }
+            }
+        }
+        next[c] = get_next_state(options.rule, cells[y][x], alive_neighbors);
+    }
+    return find_node(pool, next[0], next[1], next[2], next[3]);
+}
+
+/* The center half of a level m node, 2^log_gens generations ahead;
+ * log_gens <= m - 2. */
+static node_id_t successor(node_pool_t* pool, node_id_t id, int log_gens) {
+    const node_t* node = &pool->nodes[id];
+    const int level = node->level;
+    if (node->result != kNoNode && node->result_log == log_gens) {
+        return node->result;
+    }
+    /* Empty space stays empty unless the rule has B0. */
+    if (id == pool->empty[level] && !get_next_state(options.rule, false, 0)) {
+        return pool->empty[level - 1];
+    }
+
+    node_id_t result;
+    if (level == 2) {
+        result = step_level2(pool, id);
+    } else {
+        node_id_t nw = child(pool, id, kNW), ne = child(pool, id, kNE);
+        node_id_t sw = child(pool, id, kSW), se = child(pool, id, kSE);
+
+        node_id_t parts[9] = {
+            nw,
+            find_node(pool, child(pool, nw, kNE), child(pool, ne, kNW),
+                      child(pool, nw, kSE), child(pool, ne, kSW)),
+            ne,
+            find_node(pool, child(pool, nw, kSW), child(pool, nw, kSE),
+                      child(pool, sw, kNW), child(pool, sw, kNE)),
+            find_node(pool, child(pool, nw, kSE), child(pool, ne, kSW),
+                      child(pool, sw, kNE), child(pool, se, kNW)),
+            find_node(pool, child(pool, ne, kSW), child(pool, ne, kSE),
+                      child(pool, se, kNW), child(pool, se, kNE)),
+            sw,
+            find_node(pool, child(pool, sw, kNE), child(pool, se, kNW),
+                      child(pool, sw, kSE), child(pool, se, kSW)),
+            se,
+        };
+
+        /* A full-speed step spends half of the generations on each of the
+         * two rounds; a slower one just crops the parts in the first. */
+        const bool full_speed = log_gens == level - 2;
+        for (int i = 0; i < 9; ++i) {
+            parts[i] = full_speed ? successor(pool, parts[i], level - 3)
+                                  : centered(pool, parts[i]);
+        }
+        const int next_log = full_speed ? level - 3 : log_gens;
+
+        node_id_t quarters[4];
+        for (int q = 0; q < 4; ++q) {
+            int base = (q / 2) * 3 + q % 2;
+            node_id_t square = find_node(pool, parts[base], parts[base + 1],
+                                         parts[base + 3], parts[base + 4]);
+            quarters[q] = successor(pool, square, next_log);
+        }
+        result = find_node(pool, quarters[0], quarters[1], quarters[2], quarters[3]);
+    }
+
+    pool->nodes[id].result = result;
+    pool->nodes[id].result_log = log_gens;
+    return result;
+}
+
+static node_id_t build_node(node_pool_t* pool, const field_t* field,
+                            int x0, int y0, int level) {
+    if (level == 0) {
+        return get_cell(field, x0 % field->width, y0 % field->height);
+    }
+
+    const int half = 1 << (level - 1);
+    if (level == 6 && field->height >= kCellsPerWord) {
+        /* A 64x64 square is 64 aligned words, skip it if they are empty. */
+        bool empty = true;
+        for (int x = x0; x < x0 + 2 * half && empty; ++x) {
+            empty = get_column(field, x % field->width)[(y0 % field->height) /
+                                                        kCellsPerWord] == 0;
+        }
+        if (empty) {
+            return pool->empty[level];
+        }
+    }
+
+    node_id_t nw = build_node(pool, field, x0, y0, level - 1);
+    node_id_t ne = build_node(pool, field, x0 + half, y0, level - 1);
+    node_id_t sw = build_node(pool, field, x0, y0 + half, level - 1);
+    node_id_t se = build_node(pool, field, x0 + half, y0 + half, level - 1);
+    return find_node(pool, nw, ne, sw, se);
+}
+
+static void flatten_node(const node_pool_t* pool, node_id_t id, int level,
+                         int x0, int y0, field_t* field) {
+    if (x0 >= field->width || y0 >= field->height || id == pool->empty[level]) {
+        return;
+    }
+    if (level == 0) {
+        set_cell(field, x0, y0, true);
+        return;
+    }
+
+    const int half = 1 << (level - 1);
+    flatten_node(pool, child(pool, id, kNW), level - 1, x0, y0, field);
+    flatten_node(pool, child(pool, id, kNE), level - 1, x0 + half, y0, field);
+    flatten_node(pool, child(pool, id, kSW), level - 1, x0, y0 + half, field);
+    flatten_node(pool, child(pool, id, kSE), level - 1, x0 + half, y0 + half, field);
+}
+
+/* Advances the torus by 2^log_gens generations. The level M node made of
+ * copies of the board yields the plane shifted by 2^(M-2) cells; that is a
+ * whole number of periods once M - 2 >= level, and half a period otherwise,
+ * which is undone by swapping diagonal quadrants. */
+static node_id_t advance_root(node_pool_t* pool, node_id_t root, int level, int log_gens) {
+    int top_level = level + 1 > log_gens + 2 ? level + 1 : log_gens + 2;
+
+    node_id_t tiled = root;
+    for (int l = level; l < top_level; ++l) {
+        tiled = find_node(pool, tiled, tiled, tiled, tiled);
+    }
+
+    node_id_t result = successor(pool, tiled, log_gens);
+    if (top_level - 2 >= level) {
+        for (int l = top_level - 1; l > level; --l) {
+            result = child(pool, result, kNW);
+        }
+        return result;
+    }
+    return find_node(pool, child(pool, result, kSE), child(pool, result, kSW),
+                     child(pool, result, kNE), child(pool, result, kNW));
+}
+
+static inline long long min_ll(long long x, long long y) {
+    return x < y ? x : y;
+}
+
+void* hashlife_thread(void* arg) {
+    struct workers_internal* data = arg;
+
+    while (true) {
+        pthread_mutex_lock(&data->mtx_gen);
+        data->idle_since_ns = get_time_ns();
+        while (data->required_gen <= data->current_gen && data->stable_state != kStableRequested &&
+               !data->stop_required) {
+            pthread_cond_wait(&data->cv_gen, &data->mtx_gen);
+        }
+        data->stats.idle_ns += get_time_ns() - data->idle_since_ns;
+        data->idle_since_ns = 0;
+        if (data->stop_required) {
+            pthread_mutex_unlock(&data->mtx_gen);
+            break;
+        }
+        pthread_mutex_unlock(&data->mtx_gen);
+
+        /* `load` replaces the root and the generation together under
+         * mtx_pool, so both are read again under it. */
+        pthread_mutex_lock(&data->mtx_pool);
+        pthread_mutex_lock(&data->mtx_gen);
+        if (data->stable_state == kStableRequested) {
+            detect_cycle(&data->detector, (uint64_t)data->root);
+            data->required_gen = data->current_gen + data->stable_limit;
+            data->stable_state = kStableDetecting;
+        }
+        const bool detecting = data->stable_state == kStableDetecting;
+        long long remaining = data->required_gen - data->current_gen;
+        pthread_mutex_unlock(&data->mtx_gen);
+
+        if (remaining > 0) {
+            int log_gens = 0;
+            while (!detecting && log_gens < data->jump_log && (2LL << log_gens) <= remaining) {
+                ++log_gens;
+            }
+
+            const long long pass_start = get_time_ns();
+            data->root = advance_root(&data->pool, data->root, data->level, log_gens);
+            if (data->pool.count > options.node_cache) {
+                /* run-until-stable may replace the history meanwhile. */
+                pthread_mutex_lock(&data->mtx_gen);
+                collect_garbage(&data->pool, data->root,
+                                data->stable_state != kStableOff ? &data->detector : NULL);
+                pthread_mutex_unlock(&data->mtx_gen);
+            }
+            const long long pass_ns = get_time_ns() - pass_start;
+
+            /* Cost is not proportional to the jump: periodic regions are
+             * memoized, so the jump doubles while passes stay cheap. */
+            if (pass_ns > kJumpBudgetNs) {
+                data->jump_log = log_gens > 0 ? log_gens - 1 : 0;
+            } else if (pass_ns < kJumpBudgetNs / 2 && log_gens == data->jump_log &&
+                       data->jump_log < kMaxLevel - 4) {
+                ++data->jump_log;
+            }
+
+            pthread_mutex_lock(&data->mtx_gen);
+            data->current_gen += 1LL << log_gens;
+            ++data->stats.passes;
+            data->stats.pass_ns += pass_ns;
+            data->stats.max_pass_ns = pass_ns > data->stats.max_pass_ns ? pass_ns
+                                                                        : data->stats.max_pass_ns;
+            data->stats.busy_ns += pass_ns;
+            data->stats.generation = data->current_gen;
+            stats_t stats = data->stats;
+            /* A run-until-stable asked for again meanwhile starts over. */
+            if (detecting && data->stable_state == kStableDetecting) {
+                const int period = detect_cycle(&data->detector, (uint64_t)data->root);
+                if (period > 0 || data->current_gen >= data->required_gen) {
+                    destroy_cycle_detector(&data->detector);
+                    data->required_gen = data->current_gen;
+                    data->stable_state = kStableOff;
+                    print_cycle(data->current_gen, period);
+                }
+            }
+            pthread_cond_broadcast(&data->cv_gen);
+            pthread_mutex_unlock(&data->mtx_gen);
+
+            if (is_trace_due()) {
+                write_trace(&stats);
+            }
+        }
+        pthread_mutex_unlock(&data->mtx_pool);
+    }
+
+    pthread_exit(NULL);
+}
+
+const char* get_version() {
+    return "0.1_hashlife";
+}
+
+static bool is_power_of_two(int x) {
+    return x > 0 && (x & (x - 1)) == 0;
+}
+
+const char* setup_workers(field_t* field, workers_t* workers) {
+    if (!is_power_of_two(field->width) || !is_power_of_two(field->height)) {
+        return "HashLife backend requires power-of-two field sides";
+    }
+
+    workers->impl = calloc(1, sizeof(struct workers_internal));
+    struct workers_internal* data = workers->impl;
+
+    data->width = field->width;
+    data->height = field->height;
+    data->level = 0;
+    while ((1 << data->level) < field->width || (1 << data->level) < field->height) {
+        ++data->level;
+    }
+
+    init_pool(&data->pool);
+    data->root = build_node(&data->pool, field, 0, 0, data->level);
+
+    data->required_gen = 0;
+    data->current_gen = 0;
+    data->stop_required = false;
+    data->jump_log = 0;
+    data->stats.workers = 1;
+    data->stable_state = kStableOff;
+
+    pthread_mutex_init(&data->mtx_gen, NULL);
+    pthread_cond_init(&data->cv_gen, NULL);
+    pthread_mutex_init(&data->mtx_pool, NULL);
+
+    pthread_create(&data->thread, NULL, hashlife_thread, data);
+    return NULL;
+}
+
+void destroy_workers(workers_t* workers) {
+    struct workers_internal* data = workers->impl;
+
+    pthread_mutex_lock(&data->mtx_gen);
+    data->stop_required = true;
+    pthread_cond_broadcast(&data->cv_gen);
+    pthread_mutex_unlock(&data->mtx_gen);
+
+    void* ret_val = NULL;
+    pthread_join(data->thread, &ret_val);
+
+    pthread_mutex_destroy(&data->mtx_gen);
+    pthread_cond_destroy(&data->cv_gen);
+    pthread_mutex_destroy(&data->mtx_pool);
+
+    if (data->stable_state != kStableOff) {
+        destroy_cycle_detector(&data->detector);
+    }
+    destroy_pool(&data->pool);
+    free(data);
+}
+
+/* Waits for the pass in flight and writes the board into `field`. */
+static long long flatten_root(struct workers_internal* data, field_t* field) {
+    const long long start = get_time_ns();
+    pthread_mutex_lock(&data->mtx_pool);
+    memset(field->storage, 0, (size_t)(field->width + 2) * field->stride * sizeof(uint64_t));
+    flatten_node(&data->pool, data->root, data->level, 0, 0, field);
+
+    pthread_mutex_lock(&data->mtx_gen);
+    const long long current_gen = data->current_gen;
+    ++data->stats.snapshots;
+    data->stats.snapshot_ns += get_time_ns() - start;
+    pthread_mutex_unlock(&data->mtx_gen);
+    pthread_mutex_unlock(&data->mtx_pool);
+    return current_gen;
+}
+
+void dump_field(field_t* field, workers_t* workers) {
+    const long long current_gen = flatten_root(workers->impl, field);
+    print_field(field, current_gen);
+}
+
+void dump_stats(field_t* field, workers_t* workers) {
+    pthread_mutex_lock(&workers->impl->mtx_gen);
+    stats_t stats = workers->impl->stats;
+    stats.generation = workers->impl->current_gen;
+    if (workers->impl->idle_since_ns > 0) {
+        stats.idle_ns += get_time_ns() - workers->impl->idle_since_ns;
+    }
+    pthread_mutex_unlock(&workers->impl->mtx_gen);
+    print_stats(&stats);
+}
+
+void save_field(field_t* field, workers_t* workers) {
+    char path[kMaxPathLength];
+    if (!scan_path(path)) {
+        return;
+    }
+
+    const long long current_gen = flatten_root(workers->impl, field);
+    const char* err_msg = save_snapshot(path, field, current_gen);
+    if (err_msg != NULL) {
+        printf("# %s\n", err_msg);
+    }
+}
+
+/* Ends a run-until-stable with no cycle found, whether the thread has
+ * picked it up or not. Called with mtx_gen held. */
+static void end_stable_run(struct workers_internal* data) {
+    if (data->stable_state != kStableOff) {
+        destroy_cycle_detector(&data->detector);
+        data->stable_state = kStableOff;
+        print_cycle(data->current_gen, 0);
+    }
+}
+
+/* Stops the run once the pass in flight, if any, lets go of mtx_pool. */
+void load_field(field_t* field, workers_t* workers) {
+    char path[kMaxPathLength];
+    if (!scan_path(path)) {
+        return;
+    }
+
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_pool);
+    long long gen = 0;
+    const char* err_msg = load_snapshot(path, field, &gen);
+    if (err_msg == NULL) {
+        data->root = build_node(&data->pool, field, 0, 0, data->level);
+    }
+    pthread_mutex_lock(&data->mtx_gen);
+    end_stable_run(data);
+    if (err_msg == NULL) {
+        data->current_gen = gen;
+    }
+    data->required_gen = data->current_gen;
+    pthread_mutex_unlock(&data->mtx_gen);
+    pthread_mutex_unlock(&data->mtx_pool);
+
+    if (err_msg != NULL) {
+        printf("# %s\n", err_msg);
+    }
+}
+
+void run(field_t* field, workers_t* workers) {
+    int n = 0;
+    if (!scan_count(&n)) {
+        return;
+    }
+
+    run_generations(workers, n);
+}
+
+/* Replaces whatever run is in progress, be it a run-until-stable too. The
+ * outcome is printed once the run ends. */
+void run_until_stable(field_t* field, workers_t* workers) {
+    int limit = 0;
+    if (!scan_limit(&limit)) {
+        return;
+    }
+
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_gen);
+    if (data->stable_state != kStableOff) {
+        destroy_cycle_detector(&data->detector);
+    }
+    init_cycle_detector(&data->detector);
+    data->stable_limit = limit > 0 ? limit : INT_MAX;
+    data->stable_state = kStableRequested;
+    pthread_cond_broadcast(&data->cv_gen);
+    pthread_mutex_unlock(&data->mtx_gen);
+}
+
+void run_generations(workers_t* workers, int n) {
+    pthread_mutex_lock(&workers->impl->mtx_gen);
+    workers->impl->required_gen += n;
+    pthread_cond_broadcast(&workers->impl->cv_gen);
+    pthread_mutex_unlock(&workers->impl->mtx_gen);
+}
+
+void finish_generations(workers_t* workers) {
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_gen);
+    while (data->current_gen < data->required_gen && !data->stop_required) {
+        pthread_cond_wait(&data->cv_gen, &data->mtx_gen);
+    }
+    pthread_mutex_unlock(&data->mtx_gen);
+}
+
+/* A run-until-stable the thread has not picked up yet ends right away. */
+void stop(field_t* field, workers_t* workers) {
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_gen);
+    data->required_gen = min_ll(data->current_gen + 1, data->required_gen);
+    if (data->stable_state == kStableRequested) {
+        end_stable_run(data);
+    }
+    pthread_mutex_unlock(&data->mtx_gen);
+}
@@ -1,43 +1,195 @@
 #include <interface.h>
+#include <kernel.h>
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
 
-#define LOG DEBUG("")
-#define DEBUG(format, ...) printf("%s, %s:%d:" format "\n", __func__, __FILE__, __LINE__, ## __VA_ARGS__)
+/* bin/game_hybrid builds this file with OpenMP: then every rank computes a
+ * block with all of its threads, and rank 0 also holds the board and runs
+ * the master, with commands coming from an I/O thread. Only the thread
+ * that called MPI_Init_thread talks to MPI. */
+#ifdef _OPENMP
+#include <omp.h>
+#include <pthread.h>
+#endif
 
 static inline int min(int x, int y) {
     return x < y ? x : y;
 }
 
+static inline int max(int x, int y) {
+    return x > y ? x : y;
+}
+
 typedef enum {
-    kInitialHeightTag,
-    kInitialSizeTag,
+    kInitialLayoutTag,
     kInitialDataTag,
-    kStopRequiredTag,
     kDataTag,
     kCmdTag,
+    kHaloTag,
+    kGatherTag = kHaloTag + 9,
+    kMigrateLeftTag,
+    kMigrateRightTag,
 } tag_t;
 
+/* Commands the master broadcasts over the compute communicator, each with
+ * an argument: generations to step, whether to keep tile hashes, halo
+ * depths to try or the size of a snapshot's header. */
+typedef enum {
+    kStepCmd,
+    kHashCmd,
+    kGatherCmd,
+    kTuneCmd,
+    kRebalanceCmd,
+    kSaveCmd,
+    kLoadCmd,
+    kHaltCmd,
+} slave_cmd_t;
+
+/* --halo=auto times every power of two up to the deepest halo the blocks
+ * allow on this many generations and keeps the fastest. */
+#define kTuneGenerations 64
+#define kMaxTuneDepths 7
+
+/* Every this many generations the master compares the compute time the
+ * columns of blocks took, and moves the borders between them once the same
+ * column has been this much behind the average for this many windows in a
+ * row. Every cell costs the same to compute, so a column only stays behind
+ * if its ranks are slower: slower cores, a node shared with other jobs or
+ * hybrid ranks with fewer threads. Windows a column is behind only once are
+ * timing noise. */
+#define kRebalanceGenerations 256
+#define kRebalanceThreshold 0.1
+#define kRebalanceWindows 4
+
+/* What every compute rank reports to the master after a step: its compute
+ * time, the time it waited for halos, the messages and bytes it has sent
+ * since the last report, and the hash of its block while it keeps one, in
+ * two 32-bit halves a double holds exactly. */
+enum { kAckBusy, kAckWaited, kAckMessages, kAckBytes, kAckHashLow, kAckHashHigh, kAckValues };
+
+/* Tiles a slave keeps hashes of during a run-until-stable. */
+#define kHashTileWidth 64
+#define kHashTileWords 8
+
+/* Cells [from_x, to_x] x [from_y, to_y] of the board. Blocks are cut at
+ * multiples of 64 rows, so each of them owns whole words of its columns. */
 typedef struct {
-    int from, to;
-} range_t;
+    int from_x, to_x;
+    int from_y, to_y;
+} block_t;
+
+/* What the master tells every slave at startup. */
+typedef struct {
+    int board_width, board_height;
+    int grid_width, grid_height;
+    int halo;
+    block_t block;
+    rule_t rule;
+} layout_t;
+
+/* A slave's block with `halo` halo columns on both sides and a halo word
+ * of 64 rows above and below it: own cells start at column `halo`, row 64
+ * of `field`. A block can be advanced up to `halo` generations between two
+ * exchanges with the eight neighbors on the process grid, which send just
+ * as many halo columns as needed. Piece d of the buffers goes to or comes
+ * from the neighbor at offset (d % 3 - 1, d / 3 - 1). */
+typedef struct {
+    int width, height, words;
+    int halo;
+    field_t field, next_field;
+    /* Where the block is on the board and on the grid. Rebalancing moves
+     * the left and right borders of blocks. */
+    block_t block;
+    int grid_x, grid_width;
+    int board_width, board_words;
+
+    MPI_Comm grid;
+    int neighbors[9];
+    uint64_t* send_buffers[9];
+    uint64_t* recv_buffers[9];
+    /* Raw piece words when pieces are run-length encoded, and room for the
+     * whole block raw and encoded when it is sent to the master. */
+    uint64_t* piece;
+    uint64_t* transfer;
+    MPI_Request requests[16];
+
+    /* During a run-until-stable: a hash of every tile of the block, and
+     * which tiles the last generation changed. Only tiles that may have
+     * changed are compared and only changed ones rehashed. */
+    bool hashing;
+    tiling_t tiling;
+    uint64_t* tile_hashes;
+    uint8_t* changed;
+    uint8_t* next_changed;
+} slave_t;
 
 struct workers_internal {
     field_t* field;
-    field_t* next_field;
-    range_t* ranges;
-    int ranges_cnt;
+    block_t* blocks;
+    int blocks_cnt;
+    int grid_width, grid_height;
+    /* Acks of every compute rank for the last step, and the compute time
+     * of every slave since the last rebalancing. */
+    double* acks;
+    double* costs;
+    int balanced_gen;
+    /* The column of blocks behind in the last windows and how many. */
+    int slow_column, slow_windows;
+    stats_t stats;
+    /* Room for the largest block raw and encoded, for --rle=on transfers. */
+    uint64_t* transfer;
 
     int cur_gen, req_gen;
+    /* Generations per halo exchange. */
+    int depth;
+    int max_depth;
+    /* Generation held by `field`, which is only brought up to date when a
+     * dump asks for it. */
+    int gathered_gen;
+    /* Set during a `run-until-stable`, which hashes every generation; the
+     * hash is the sum of the ones the ranks report with their acks. */
+    bool detecting;
+    uint64_t hash;
+    cycle_detector_t detector;
+#ifdef _OPENMP
+    /* Block 0, which the master computes itself. */
+    slave_t slave;
+#endif
 };
 
+#define kCenterPiece 4
+
+#ifdef _OPENMP
+#define kMinThreadColumns 64
+#endif
+
 const char* get_version() {
     return "0.1_mpi";
 }
 
-static field_t second_field;
+#ifdef _OPENMP
+static int get_slaves_count() {
+    int world_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    return world_size;
+}
 
+static inline int get_slave_rank(int slave_index) {
+    return slave_index;
+}
+
+static inline int get_master_rank() {
+    return 0;
+}
+
+static inline int get_compute_rank(int slave_index) {
+    return slave_index;
+}
+#else
 static int get_slaves_count() {
     int world_size;
     MPI_Comm_size(MPI_COMM_WORLD, &world_size);
@@ -56,216 +208,1435 @@ static inline int get_io_rank() {
     return 0;
 }
 
+static inline int get_compute_rank(int slave_index) {
+    return slave_index + 1;
+}
+#endif
+
+/* The master and the slaves, the master being rank 0 in it. The I/O rank
+ * stays out, so collectives over it only wait for ranks that take part in
+ * the computation. */
+static MPI_Comm compute_comm = MPI_COMM_NULL;
+
+static MPI_Comm get_compute_comm() {
+    if (compute_comm == MPI_COMM_NULL) {
+#ifdef _OPENMP
+        MPI_Comm_dup(MPI_COMM_WORLD, &compute_comm);
+#else
+        MPI_Group world_group, compute_group;
+        MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+        int range[1][3] = {{get_master_rank(), get_slave_rank(get_slaves_count() - 1), 1}};
+        MPI_Group_range_incl(world_group, 1, range, &compute_group);
+        MPI_Comm_create_group(MPI_COMM_WORLD, compute_group, 0, &compute_comm);
+        MPI_Group_free(&compute_group);
+        MPI_Group_free(&world_group);
+#endif
+    }
+    return compute_comm;
+}
+
+/* Picks the grid_width x grid_height process grid with the smallest halo
+ * per block, counted in words: a halo column takes a word per 64 rows, a
+ * halo row a word per column. */
+static const char* choose_grid(int slaves, const field_t* field,
+                               int* grid_width, int* grid_height) {
+    long best_cost = -1;
+    for (int px = 1; px <= slaves; ++px) {
+        int py = slaves / px;
+        if (px * py != slaves || px > field->width ||
+            (py > 1 && py > field->height / kCellsPerWord)) {
+            continue;
+        }
+        long cost = (field->width + px - 1) / px +
+                    ((field->height + py - 1) / py + kCellsPerWord - 1) / kCellsPerWord;
+        if (best_cost < 0 || cost < best_cost) {
+            best_cost = cost;
+            *grid_width = px;
+            *grid_height = py;
+        }
+    }
+    return best_cost < 0 ? "MPI backend cannot split the board between that many ranks" : NULL;
+}
+
+/* `width` columns of `field`, `words` words of each. */
+static MPI_Datatype make_block_type(const field_t* field, int width, int words) {
+    MPI_Datatype type;
+    MPI_Type_vector(width, words, field->stride, MPI_UINT64_T, &type);
+    MPI_Type_commit(&type);
+    return type;
+}
+
+static int get_block_words(const block_t* block) {
+    return (block->to_y - block->from_y) / kCellsPerWord + 1;
+}
+
+/* With --rle=on words go over the wire as runs, each a header word with
+ * the number of zero words in its high half and the number of words that
+ * follow the header in its low half. A message no shorter than the words
+ * themselves is sent as is instead, so the receiver tells the two apart by
+ * its length. */
+static int encode_words(const uint64_t* in, int count, uint64_t* out) {
+    int i = 0, length = 0;
+    while (i < count) {
+        int zeros = 0;
+        while (i + zeros < count && in[i + zeros] == 0) {
+            ++zeros;
+        }
+        i += zeros;
+        /* Lone zero words cost no more as literals than as a run. */
+        int literals = 0;
+        while (i + literals < count && (in[i + literals] != 0 ||
+               (i + literals + 1 < count && in[i + literals + 1] != 0))) {
+            ++literals;
+        }
+        if (length + 1 + literals >= count) {
+            memcpy(out, in, count * sizeof(uint64_t));
+            return count;
+        }
+        out[length++] = (uint64_t)zeros << 32 | (uint64_t)literals;
+        memcpy(out + length, in + i, literals * sizeof(uint64_t));
+        length += literals;
+        i += literals;
+    }
+    return length;
+}
+
+static void decode_words(const uint64_t* in, int length, uint64_t* out, int count) {
+    if (length == count) {
+        memcpy(out, in, count * sizeof(uint64_t));
+        return;
+    }
+    for (int i = 0; i < length;) {
+        int zeros = (int)(in[i] >> 32), literals = (int)(uint32_t)in[i];
+        memset(out, 0, zeros * sizeof(uint64_t));
+        memcpy(out + zeros, in + i + 1, literals * sizeof(uint64_t));
+        out += zeros + literals;
+        i += 1 + literals;
+    }
+}
+
+/* Sent by this rank and waited for halos since its last ack. */
+static long long sent_messages, sent_bytes;
+static double halo_waited;
+
+static void count_message(long long words) {
+    ++sent_messages;
+    sent_bytes += words * (long long)sizeof(uint64_t);
+}
+
+static void make_ack(double busy, uint64_t hash, double ack[kAckValues]) {
+    ack[kAckBusy] = busy;
+    ack[kAckWaited] = halo_waited;
+    ack[kAckMessages] = sent_messages;
+    ack[kAckBytes] = sent_bytes;
+    ack[kAckHashLow] = (uint32_t)hash;
+    ack[kAckHashHigh] = (uint32_t)(hash >> 32);
+    sent_messages = sent_bytes = 0;
+    halo_waited = 0;
+}
+
+/* Columns [from_x, from_x + width) of `field`, words [from_w, from_w + words)
+ * of each, sent straight from the field or, run-length encoded, through
+ * `buffer`, which has room for 2 * width * words words. */
+static void send_block(const field_t* field, int from_x, int width, int from_w, int words,
+                       uint64_t* buffer, int dest, int tag, MPI_Comm comm) {
+    if (!options.run_length_transfers) {
+        MPI_Datatype type = make_block_type(field, width, words);
+        MPI_Send(get_column(field, from_x) + from_w, 1, type, dest, tag, comm);
+        MPI_Type_free(&type);
+        count_message((long long)width * words);
+        return;
+    }
+    const int count = width * words;
+    uint64_t* raw = buffer;
+    for (int x = 0; x < width; ++x) {
+        memcpy(raw + (size_t)x * words, get_column(field, from_x + x) + from_w,
+               words * sizeof(uint64_t));
+    }
+    uint64_t* encoded = raw + count;
+    int length = encode_words(raw, count, encoded);
+    MPI_Send(encoded, length, MPI_UINT64_T, dest, tag, comm);
+    count_message(length);
+}
+
+static void copy_block(const field_t* from, int from_x, int from_w,
+                       field_t* to, int to_x, int to_w, int width, int words) {
+    for (int x = 0; x < width; ++x) {
+        memcpy(get_column(to, to_x + x) + to_w, get_column(from, from_x + x) + from_w,
+               words * sizeof(uint64_t));
+    }
+}
+
+static void recv_block(field_t* field, int from_x, int width, int from_w, int words,
+                       uint64_t* buffer, int source, int tag, MPI_Comm comm) {
+    if (!options.run_length_transfers) {
+        MPI_Datatype type = make_block_type(field, width, words);
+        MPI_Recv(get_column(field, from_x) + from_w, 1, type, source, tag, comm,
+                 MPI_STATUS_IGNORE);
+        MPI_Type_free(&type);
+        return;
+    }
+    const int count = width * words;
+    uint64_t* raw = buffer;
+    uint64_t* encoded = raw + count;
+    MPI_Status status;
+    int length;
+    MPI_Recv(encoded, count, MPI_UINT64_T, source, tag, comm, &status);
+    MPI_Get_count(&status, MPI_UINT64_T, &length);
+    decode_words(encoded, length, raw, count);
+    for (int x = 0; x < width; ++x) {
+        memcpy(get_column(field, from_x + x) + from_w, raw + (size_t)x * words,
+               words * sizeof(uint64_t));
+    }
+}
+
+/* Sized for the largest block once the blocks are laid out or moved. */
+static void reserve_transfer(struct workers_internal* data) {
+    if (!options.run_length_transfers) {
+        return;
+    }
+    size_t count = 0;
+    for (int i = 0; i < data->blocks_cnt; ++i) {
+        const block_t* block = &data->blocks[i];
+        const size_t block_count = (size_t)(block->to_x - block->from_x + 1) *
+                                   get_block_words(block);
+        count = block_count > count ? block_count : count;
+    }
+    free(data->transfer);
+    data->transfer = malloc(2 * count * sizeof(uint64_t));
+}
+
+static void init_slave(slave_t* slave, const layout_t* layout);
+static void join_grid(slave_t* slave, const layout_t* layout);
+
 const char* setup_workers(field_t* field, workers_t* workers) {
-    LOG;
     workers->impl = calloc(1, sizeof(struct workers_internal));
-    init_field(&second_field, field->width, field->height);
     workers->impl->field = field;
-    workers->impl->next_field = &second_field;
 
     workers->impl->cur_gen = 0;
     workers->impl->req_gen = 0;
+    workers->impl->gathered_gen = 0;
+    workers->impl->detecting = false;
 
     int num_of_slaves = get_slaves_count();
-    workers->impl->ranges = calloc(num_of_slaves, sizeof(range_t));
-    workers->impl->ranges_cnt = num_of_slaves;
+    workers->impl->blocks = calloc(num_of_slaves, sizeof(block_t));
+    workers->impl->blocks_cnt = num_of_slaves;
+    workers->impl->acks = calloc((num_of_slaves + 1) * kAckValues, sizeof(double));
+    workers->impl->costs = calloc(num_of_slaves, sizeof(double));
+    workers->impl->balanced_gen = 0;
+    workers->impl->slow_column = -1;
+    workers->impl->slow_windows = 0;
+    workers->impl->stats.workers = num_of_slaves;
 
-    int last_max_x = -1;
-    int stripe_width = (field->width - 1) / num_of_slaves + 1;
+    layout_t layout;
+    const char* err_msg = choose_grid(num_of_slaves, field,
+                                      &layout.grid_width, &layout.grid_height);
+    if (err_msg != NULL) {
+        return err_msg;
+    }
+    workers->impl->grid_width = layout.grid_width;
+    workers->impl->grid_height = layout.grid_height;
+    layout.board_width = field->width;
+    layout.board_height = field->height;
+    layout.rule = options.rule;
 
+    /* Slave i sits at (i / grid_height, i % grid_height) of the grid, as
+     * MPI_Cart_create numbers it. The last block of a column of blocks
+     * also takes the rows that do not fill a word. A halo `depth` deep is
+     * cut from a single neighbor on each side, so it can be no wider or
+     * taller than the smallest block. */
+    const int full_words = field->height / kCellsPerWord;
+    int max_depth = kCellsPerWord;
     for (int i = 0; i < num_of_slaves; ++i) {
-        workers->impl->ranges[i].from = last_max_x + 1;
-        last_max_x = workers->impl->ranges[i].to
-                   = min(last_max_x + stripe_width, field->width - 1);
+        int gx = i / layout.grid_height, gy = i % layout.grid_height;
+        block_t* block = &workers->impl->blocks[i];
+        block->from_x = (int)((long)field->width * gx / layout.grid_width);
+        block->to_x = (int)((long)field->width * (gx + 1) / layout.grid_width) - 1;
+        block->from_y = (int)((long)full_words * gy / layout.grid_height) * kCellsPerWord;
+        block->to_y = gy == layout.grid_height - 1 ? field->height - 1 :
+                      (int)((long)full_words * (gy + 1) / layout.grid_height) * kCellsPerWord - 1;
+        max_depth = min(max_depth, min(block->to_x - block->from_x + 1,
+                                       block->to_y - block->from_y + 1));
+    }
+    if (options.halo_depth > max_depth) {
+        return "--halo is deeper than the smallest block allows";
+    }
+    workers->impl->max_depth = max_depth;
+    reserve_transfer(workers->impl);
+    workers->impl->depth = options.halo_depth > 0 ? options.halo_depth : 0;
+    layout.halo = options.halo_depth > 0 ? options.halo_depth : max_depth;
 
-        MPI_Send(&field->height, 1, MPI_INT, get_slave_rank(i),
-                 kInitialHeightTag, MPI_COMM_WORLD);
-        MPI_Send(workers->impl->ranges + i, 2, MPI_INT, get_slave_rank(i),
-                 kInitialSizeTag, MPI_COMM_WORLD);
-        MPI_Send(get_cell(field, workers->impl->ranges[i].from, 0),
-                (workers->impl->ranges[i].to - workers->impl->ranges[i].from + 1)
-                * field->height, MPI_INT, get_slave_rank(i),
-                kInitialDataTag, MPI_COMM_WORLD);
+    for (int i = 0; i < num_of_slaves; ++i) {
+        const block_t* block = &workers->impl->blocks[i];
+        if (get_slave_rank(i) == get_master_rank()) {
+            continue;
+        }
+        layout.block = *block;
+        MPI_Send(&layout, sizeof(layout_t) / sizeof(int), MPI_INT, get_slave_rank(i),
+                 kInitialLayoutTag, MPI_COMM_WORLD);
+        send_block(field, block->from_x, block->to_x - block->from_x + 1,
+                   block->from_y / kCellsPerWord, get_block_words(block),
+                   workers->impl->transfer, get_slave_rank(i), kInitialDataTag,
+                   MPI_COMM_WORLD);
     }
 
+#ifdef _OPENMP
+    slave_t* slave = &workers->impl->slave;
+    layout.block = workers->impl->blocks[0];
+    init_slave(slave, &layout);
+    copy_block(field, layout.block.from_x, layout.block.from_y / kCellsPerWord,
+               &slave->field, slave->halo, 1, slave->width, slave->words);
+    join_grid(slave, &layout);
+#else
+    /* Slaves split the compute communicator to build their grid. */
+    MPI_Comm slaves_comm;
+    MPI_Comm_split(get_compute_comm(), MPI_UNDEFINED, 0, &slaves_comm);
+#endif
     return NULL;
 }
 
-void run_slave_loop() {
-    int height;
-    range_t range;
-    MPI_Recv(&height, 1, MPI_INT, get_master_rank(), kInitialHeightTag,
-             MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-    MPI_Recv(&range, 2, MPI_INT, get_master_rank(), kInitialSizeTag,
-             MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+/* 64 rows of `column` starting at `row`, which need not be word-aligned. */
+static inline uint64_t extract_rows(const uint64_t* column, int row) {
+    const int word = row / kCellsPerWord, shift = row % kCellsPerWord;
+    if (shift == 0) {
+        return column[word];
+    }
+    return column[word] >> shift | column[word + 1] << (kCellsPerWord - shift);
+}
 
-    field_t field, next_field;
-    init_field(&field, range.to - range.from + 3, height);
-    init_field(&next_field, range.to - range.from + 3, height);
-
-    MPI_Recv(get_cell(&field, 1, 0), (range.to - range.from + 1) * height, MPI_INT,
-             get_master_rank(), kInitialDataTag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-    int stop_required = 0;
-    while (true) {
-        LOG;
-        MPI_Recv(&stop_required, 1, MPI_INT, get_master_rank(), kStopRequiredTag,
-                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        if (stop_required == 1) {
-            break;
+static inline void deposit_rows(uint64_t* column, int row, uint64_t rows) {
+    const int word = row / kCellsPerWord, shift = row % kCellsPerWord;
+    if (shift == 0) {
+        column[word] = rows;
+        return;
+    }
+    const uint64_t low_mask = ((uint64_t)1 << shift) - 1;
+    column[word] = (column[word] & low_mask) | rows << shift;
+    column[word + 1] = (column[word + 1] & ~low_mask) | rows >> (kCellsPerWord - shift);
+}
+
+/* Local columns a piece for an exchange `depth` deep is taken from
+ * (`send`) or put to. */
+static void get_piece_columns(const slave_t* slave, int dx, int depth, bool send,
+                              int* from, int* to) {
+    const int halo = slave->halo;
+    if (dx == 0) {
+        *from = halo;
+        *to = halo + slave->width - 1;
+    } else if (dx < 0) {
+        *from = send ? halo : halo - depth;
+        *to = *from + depth - 1;
+    } else {
+        *from = send ? halo + slave->width - depth : halo + slave->width;
+        *to = *from + depth - 1;
+    }
+}
+
+static int get_piece_count(const slave_t* slave, int d, int depth) {
+    int from, to;
+    get_piece_columns(slave, d % 3 - 1, depth, true, &from, &to);
+    return (to - from + 1) * (d / 3 == 1 ? slave->words : 1);
+}
+
+/* Pieces above and below the block are as wide as the block. */
+static void init_buffers(slave_t* slave) {
+    for (int d = 0; d < 9; ++d) {
+        int count = get_piece_count(slave, d, slave->halo);
+        slave->send_buffers[d] = malloc(count * sizeof(uint64_t));
+        slave->recv_buffers[d] = malloc(count * sizeof(uint64_t));
+    }
+    slave->piece = malloc(max(get_piece_count(slave, 1, slave->halo),
+                              get_piece_count(slave, 3, slave->halo)) * sizeof(uint64_t));
+    slave->transfer = options.run_length_transfers
+                          ? malloc(2 * (size_t)slave->width * slave->words * sizeof(uint64_t))
+                          : NULL;
+}
+
+static void destroy_buffers(slave_t* slave) {
+    for (int d = 0; d < 9; ++d) {
+        free(slave->send_buffers[d]);
+        free(slave->recv_buffers[d]);
+    }
+    free(slave->piece);
+    free(slave->transfer);
+}
+
+static void init_slave(slave_t* slave, const layout_t* layout) {
+    slave->block = layout->block;
+    slave->grid_width = layout->grid_width;
+    slave->board_width = layout->board_width;
+    slave->board_words = (layout->board_height + kCellsPerWord - 1) / kCellsPerWord;
+    slave->width = layout->block.to_x - layout->block.from_x + 1;
+    slave->height = layout->block.to_y - layout->block.from_y + 1;
+    slave->words = get_block_words(&layout->block);
+    slave->halo = layout->halo;
+    init_field(&slave->field, slave->width + 2 * slave->halo, slave->height + 2 * kCellsPerWord);
+    init_field(&slave->next_field, slave->width + 2 * slave->halo,
+               slave->height + 2 * kCellsPerWord);
+    init_buffers(slave);
+    slave->hashing = false;
+    slave->tile_hashes = NULL;
+    slave->changed = slave->next_changed = NULL;
+}
+
+/* Collective over the compute communicator, so the master has to hand out
+ * every block before it gets here. */
+static void join_grid(slave_t* slave, const layout_t* layout) {
+    int dims[2] = {layout->grid_width, layout->grid_height};
+    int periods[2] = {1, 1};
+#ifdef _OPENMP
+    MPI_Cart_create(get_compute_comm(), 2, dims, periods, 0, &slave->grid);
+#else
+    MPI_Comm slaves_comm;
+    int compute_rank;
+    MPI_Comm_rank(get_compute_comm(), &compute_rank);
+    MPI_Comm_split(get_compute_comm(), 1, compute_rank, &slaves_comm);
+    MPI_Cart_create(slaves_comm, 2, dims, periods, 0, &slave->grid);
+    MPI_Comm_free(&slaves_comm);
+#endif
+
+    int grid_rank, coords[2];
+    MPI_Comm_rank(slave->grid, &grid_rank);
+    MPI_Cart_coords(slave->grid, grid_rank, 2, coords);
+    slave->grid_x = coords[0];
+    for (int d = 0; d < 9; ++d) {
+        int neighbor_coords[2] = {coords[0] + d % 3 - 1, coords[1] + d / 3 - 1};
+        MPI_Cart_rank(slave->grid, neighbor_coords, &slave->neighbors[d]);
+    }
+}
+
+static void destroy_slave(slave_t* slave) {
+    free(slave->tile_hashes);
+    free(slave->changed);
+    free(slave->next_changed);
+    destroy_buffers(slave);
+    MPI_Comm_free(&slave->grid);
+    destroy_field(&slave->field);
+    destroy_field(&slave->next_field);
+}
+
+/* Side pieces carry whole words of the block's columns; pieces above and
+ * below carry 64 rows of every column, of which the first `depth` next to
+ * the block matter. */
+static void pack_piece(const slave_t* slave, int d, int depth, uint64_t* out) {
+    const int dy = d / 3 - 1;
+    int from, to;
+    get_piece_columns(slave, d % 3 - 1, depth, true, &from, &to);
+    for (int x = from; x <= to; ++x) {
+        const uint64_t* column = get_column(&slave->field, x);
+        if (dy == 0) {
+            memcpy(out, column + 1, slave->words * sizeof(uint64_t));
+            out += slave->words;
+        } else {
+            *out++ = extract_rows(column, dy < 0 ? kCellsPerWord : slave->height);
         }
+    }
+}
 
-        MPI_Recv(get_cell(&field, 0, 0), height, MPI_INT, get_master_rank(),
-                 kDataTag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-        MPI_Recv(get_cell(&field, field.width - 1, 0), height, MPI_INT,
-                get_master_rank(), kDataTag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-        for (int x = 1; x < field.width - 1; ++x) {
-            for (int y = 0; y < height; ++y) {
-                int alive_negihbors = 0;
-                for (int dx = -1; dx <= 1; ++dx) {
-                    for (int dy = -1; dy <= 1; ++dy) {
-                        if (dx == 0 && dy == 0) {
-                            continue;
-                        }
-                        int nx = x + dx;
-                        int ny = (y + dy + height) % height;
-                        if (*get_cell(&field, nx, ny)) {
-                            ++alive_negihbors;
-                        }
-                    }
-                }
+static void unpack_piece(slave_t* slave, int d, int depth, const uint64_t* in) {
+    const int dy = d / 3 - 1;
+    int from, to;
+    get_piece_columns(slave, d % 3 - 1, depth, false, &from, &to);
+    for (int x = from; x <= to; ++x) {
+        uint64_t* column = get_column(&slave->field, x);
+        if (dy == 0) {
+            memcpy(column + 1, in, slave->words * sizeof(uint64_t));
+            in += slave->words;
+        } else {
+            deposit_rows(column, dy < 0 ? 0 : kCellsPerWord + slave->height, *in++);
+        }
+    }
+}
+
+/* A piece is tagged with its index as seen by the receiver, which tells
+ * pieces apart when one rank is the neighbor on several sides. */
+static void begin_halo_exchange(slave_t* slave, int depth) {
+    int count = 0;
+    for (int d = 0; d < 9; ++d) {
+        if (d == kCenterPiece) {
+            continue;
+        }
+        MPI_Irecv(slave->recv_buffers[d], get_piece_count(slave, d, depth), MPI_UINT64_T,
+                  slave->neighbors[d], kHaloTag + d, slave->grid, &slave->requests[count++]);
+    }
+    for (int d = 0; d < 9; ++d) {
+        if (d == kCenterPiece) {
+            continue;
+        }
+        int length = get_piece_count(slave, d, depth);
+        if (options.run_length_transfers) {
+            pack_piece(slave, d, depth, slave->piece);
+            length = encode_words(slave->piece, length, slave->send_buffers[d]);
+        } else {
+            pack_piece(slave, d, depth, slave->send_buffers[d]);
+        }
+        MPI_Isend(slave->send_buffers[d], length, MPI_UINT64_T,
+                  slave->neighbors[d], kHaloTag + 8 - d, slave->grid, &slave->requests[count++]);
+        count_message(length);
+    }
+}
 
-                *get_cell(&next_field, x, y) = (alive_negihbors == 3) ||
-                    (alive_negihbors == 2 && *get_cell(&field, x, y));
+static void receive_piece(slave_t* slave, int d, int depth, const MPI_Status* statuses) {
+    if (!options.run_length_transfers) {
+        unpack_piece(slave, d, depth, slave->recv_buffers[d]);
+        return;
+    }
+    int length;
+    MPI_Get_count(&statuses[d < kCenterPiece ? d : d - 1], MPI_UINT64_T, &length);
+    decode_words(slave->recv_buffers[d], length, slave->piece,
+                 get_piece_count(slave, d, depth));
+    unpack_piece(slave, d, depth, slave->piece);
+}
+
+/* Side pieces are unpacked first: the last word of a block may share bits
+ * with the halo rows below it. Returns how long the neighbors were waited
+ * for. */
+static double finish_halo_exchange(slave_t* slave, int depth) {
+    MPI_Status statuses[16];
+    const double start = MPI_Wtime();
+    MPI_Waitall(16, slave->requests, statuses);
+    const double waited = MPI_Wtime() - start;
+    receive_piece(slave, 3, depth, statuses);
+    receive_piece(slave, 5, depth, statuses);
+    for (int d = 0; d < 9; ++d) {
+        if (d / 3 != 1) {
+            receive_piece(slave, d, depth, statuses);
+        }
+    }
+    return waited;
+}
+
+static void swap_fields(slave_t* slave) {
+    field_t temp = slave->field;
+    slave->field = slave->next_field;
+    slave->next_field = temp;
+}
+
+/* Columns [from_x, to_x], words [from_w, to_w] of the next generation. The
+ * hybrid build splits the columns between the rank's threads; narrow
+ * regions, such as the halo frame, stay on the calling thread. */
+static void step_region(slave_t* slave, int from_x, int to_x, int from_w, int to_w) {
+#ifdef _OPENMP
+    #pragma omp parallel if(to_x - from_x >= kMinThreadColumns)
+    {
+        const int width = to_x - from_x + 1;
+        const int threads = omp_get_num_threads(), thread = omp_get_thread_num();
+        step_block(&slave->field, &slave->next_field, from_x + width * thread / threads,
+                   from_x + width * (thread + 1) / threads - 1, from_w, to_w);
+    }
+#else
+    step_block(&slave->field, &slave->next_field, from_x, to_x, from_w, to_w);
+#endif
+}
+
+/* Bits of the block's last word that hold its own rows. */
+static uint64_t get_block_tail_mask(const slave_t* slave) {
+    return ~(uint64_t)0 >> (kCellsPerWord - 1 - (slave->height - 1) % kCellsPerWord);
+}
+
+/* Columns [from_x, to_x], words [from_w, to_w] of `field` hold the tile
+ * at tile column `column`, tile row `row` of the block. */
+static void get_hash_tile(const slave_t* slave, int column, int row,
+                          int* from_x, int* to_x, int* from_w, int* to_w) {
+    const tiling_t* tiling = &slave->tiling;
+    *from_x = slave->halo + get_tile_from_x(tiling, column);
+    *to_x = slave->halo + get_tile_to_x(tiling, column);
+    *from_w = 1 + row * tiling->words;
+    *to_w = row == tiling->rows - 1 ? slave->words : *from_w + tiling->words - 1;
+}
+
+/* The tile's part of the board hash, hashed where it is on the board. */
+static uint64_t hash_tile(const slave_t* slave, int column, int row) {
+    int from_x, to_x, from_w, to_w;
+    get_hash_tile(slave, column, row, &from_x, &to_x, &from_w, &to_w);
+    return hash_block(&slave->field, from_x, to_x, from_w, to_w,
+                      to_w == slave->words ? get_block_tail_mask(slave) : ~(uint64_t)0,
+                      slave->block.from_x - slave->halo, slave->block.from_y / kCellsPerWord - 1,
+                      slave->board_words);
+}
+
+static void stop_hashing_slave(slave_t* slave) {
+    free(slave->tile_hashes);
+    free(slave->changed);
+    free(slave->next_changed);
+    slave->tile_hashes = NULL;
+    slave->changed = slave->next_changed = NULL;
+    slave->hashing = false;
+}
+
+/* Hashes every tile of the block as it is now; called again once the
+ * block is replaced or resized. */
+static void start_hashing_slave(slave_t* slave) {
+    stop_hashing_slave(slave);
+    tiling_t* tiling = &slave->tiling;
+    tiling->width = min(kHashTileWidth, slave->width);
+    tiling->words = min(kHashTileWords, slave->words);
+    tiling->depth = 1;
+    tiling->columns = slave->width / tiling->width;
+    tiling->rows = slave->words / tiling->words;
+    tiling->board_width = slave->width;
+    tiling->board_words = slave->words;
+
+    const int tiles = tiling->columns * tiling->rows;
+    slave->tile_hashes = malloc(tiles * sizeof(uint64_t));
+    slave->changed = malloc(tiles);
+    slave->next_changed = malloc(tiles);
+    memset(slave->changed, 1, tiles);
+    for (int column = 0; column < tiling->columns; ++column) {
+        for (int row = 0; row < tiling->rows; ++row) {
+            slave->tile_hashes[column * tiling->rows + row] = hash_tile(slave, column, row);
+        }
+    }
+    slave->hashing = true;
+}
+
+/* A tile can only change if a tile around it did in the last generation.
+ * Tiles along the block's edge read the halo and may always change. */
+static bool may_tile_change(const slave_t* slave, int column, int row) {
+    const tiling_t* tiling = &slave->tiling;
+    if (column == 0 || row == 0 || column == tiling->columns - 1 || row == tiling->rows - 1) {
+        return true;
+    }
+    for (int dc = -1; dc <= 1; ++dc) {
+        for (int dr = -1; dr <= 1; ++dr) {
+            if (slave->changed[(column + dc) * tiling->rows + row + dr]) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool is_tile_changed(const slave_t* slave, int column, int row) {
+    int from_x, to_x, from_w, to_w;
+    get_hash_tile(slave, column, row, &from_x, &to_x, &from_w, &to_w);
+    const uint64_t tail_mask = to_w == slave->words ? get_block_tail_mask(slave) : ~(uint64_t)0;
+    for (int x = from_x; x <= to_x; ++x) {
+        const uint64_t* old_column = get_column(&slave->next_field, x);
+        const uint64_t* new_column = get_column(&slave->field, x);
+        uint64_t diff = (old_column[to_w] ^ new_column[to_w]) & tail_mask;
+        for (int w = from_w; w < to_w; ++w) {
+            diff |= old_column[w] ^ new_column[w];
+        }
+        if (diff != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* After a single generation `field` holds the block's new state and
+ * `next_field` the one before. */
+static void update_tile_hashes(slave_t* slave) {
+    const tiling_t* tiling = &slave->tiling;
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) if(tiling->columns > 1)
+#endif
+    for (int column = 0; column < tiling->columns; ++column) {
+        for (int row = 0; row < tiling->rows; ++row) {
+            const int tile = column * tiling->rows + row;
+            const bool changed = may_tile_change(slave, column, row) &&
+                                 is_tile_changed(slave, column, row);
+            slave->next_changed[tile] = changed;
+            if (changed) {
+                slave->tile_hashes[tile] = hash_tile(slave, column, row);
             }
         }
+    }
+    uint8_t* temp = slave->changed;
+    slave->changed = slave->next_changed;
+    slave->next_changed = temp;
+}
 
-        bool* temp = field.buffer;
-        field.buffer = next_field.buffer;
-        next_field.buffer = temp;
+/* The block's part of the board hash, 0 unless tiles are hashed. */
+static uint64_t get_slave_hash(const slave_t* slave) {
+    uint64_t hash = 0;
+    for (int i = 0; slave->hashing && i < slave->tiling.columns * slave->tiling.rows; ++i) {
+        hash += slave->tile_hashes[i];
+    }
+    return hash;
+}
+
+/* Exchanges the halo and advances the block by `depth` generations. The
+ * region that is still valid shrinks by a cell on every side each
+ * generation, and the block itself is what is left in the end.
+ *
+ * Columns and words of the first generation that read nothing but the
+ * block are computed while the halo is in flight; the frame around them
+ * follows once it has arrived. Returns the time it took, less the time
+ * spent waiting for the neighbors. */
+static double step_slave(slave_t* slave, int depth) {
+    const int halo = slave->halo;
+    const int first_x = halo - depth + 1, last_x = halo + slave->width + depth - 2;
+    const int first_w = (kCellsPerWord - depth + 1) / kCellsPerWord;
+    const int last_w = (kCellsPerWord + slave->height + depth - 2) / kCellsPerWord;
+    const int inner_from_x = halo + 1, inner_to_x = halo + slave->width - 2;
+    const int inner_from_w = 2, inner_to_w = slave->words - 1;
+    const double start = MPI_Wtime();
+    double waited;
 
-        MPI_Send(get_cell(&field, 1, 0), (range.to - range.from + 1) * height,
-                 MPI_INT, get_master_rank(), kDataTag, MPI_COMM_WORLD);
+    begin_halo_exchange(slave, depth);
+    if (inner_from_x <= inner_to_x && inner_from_w <= inner_to_w) {
+        step_region(slave, inner_from_x, inner_to_x, inner_from_w, inner_to_w);
+        waited = finish_halo_exchange(slave, depth);
+        step_region(slave, first_x, inner_from_x - 1, first_w, last_w);
+        step_region(slave, inner_to_x + 1, last_x, first_w, last_w);
+        step_region(slave, inner_from_x, inner_to_x, first_w, inner_from_w - 1);
+        step_region(slave, inner_from_x, inner_to_x, inner_to_w + 1, last_w);
+    } else {
+        waited = finish_halo_exchange(slave, depth);
+        step_region(slave, first_x, last_x, first_w, last_w);
     }
+    swap_fields(slave);
+    halo_waited += waited;
 
-    destroy_field(&field);
-    destroy_field(&next_field);
+    for (int gen = 2; gen <= depth; ++gen) {
+        const int margin = depth - gen;
+        step_region(slave, halo - margin, halo + slave->width - 1 + margin,
+                    (kCellsPerWord - margin) / kCellsPerWord,
+                    (kCellsPerWord + slave->height + margin - 1) / kCellsPerWord);
+        swap_fields(slave);
+    }
+    /* The master steps a generation at a time while tiles are hashed. */
+    if (slave->hashing) {
+        update_tile_hashes(slave);
+    }
+    return MPI_Wtime() - start - waited;
 }
 
-static void master_dump_field(struct workers_internal* data) {
-    printf("# Current iteration: %d\n", data->cur_gen);
-    for (int y = 0; y < data->field->height; ++y) {
-        printf("# ");
-        for (int x = 0; x < data->field->width; ++x) {
-            char ch = '_';
-            if (*get_cell(data->field, x, y)) {
-                ch = 'O';
+/* Sends or receives columns [x, x + columns) of `field` for a move of the
+ * border with `neighbor`. */
+static void post_migration(const slave_t* slave, field_t* field, int x, int columns,
+                           bool send, int neighbor, int tag,
+                           MPI_Request* request, MPI_Datatype* type) {
+    *type = make_block_type(field, columns, slave->words);
+    if (send) {
+        MPI_Isend(get_column(field, x) + 1, 1, *type, neighbor, tag, slave->grid, request);
+        count_message((long long)columns * slave->words);
+    } else {
+        MPI_Irecv(get_column(field, x) + 1, 1, *type, neighbor, tag, slave->grid, request);
+    }
+}
+
+/* Moves the block's left and right borders to `bounds`[grid_x] and
+ * `bounds`[grid_x + 1] - 1. Columns change hands between neighbors on the
+ * grid only, so a border never moves past the neighbor's far one. Columns
+ * going left are tagged kMigrateLeftTag. */
+static void rebalance_slave(slave_t* slave, const int* bounds) {
+    const block_t old = slave->block;
+    const int from_x = bounds[slave->grid_x], to_x = bounds[slave->grid_x + 1] - 1;
+    if (from_x == old.from_x && to_x == old.to_x) {
+        return;
+    }
+
+    field_t field;
+    init_field(&field, to_x - from_x + 1 + 2 * slave->halo, slave->field.height);
+    const int keep_from = max(from_x, old.from_x), keep_to = min(to_x, old.to_x);
+    copy_block(&slave->field, slave->halo + keep_from - old.from_x, 1,
+               &field, slave->halo + keep_from - from_x, 1, keep_to - keep_from + 1,
+               slave->words);
+
+    MPI_Request requests[2];
+    MPI_Datatype types[2];
+    int count = 0;
+    if (from_x < old.from_x) {
+        post_migration(slave, &field, slave->halo, old.from_x - from_x, false,
+                       slave->neighbors[3], kMigrateRightTag, &requests[count], &types[count]);
+        ++count;
+    } else if (from_x > old.from_x) {
+        post_migration(slave, &slave->field, slave->halo, from_x - old.from_x, true,
+                       slave->neighbors[3], kMigrateLeftTag, &requests[count], &types[count]);
+        ++count;
+    }
+    if (to_x > old.to_x) {
+        post_migration(slave, &field, slave->halo + old.to_x + 1 - from_x, to_x - old.to_x,
+                       false, slave->neighbors[5], kMigrateLeftTag,
+                       &requests[count], &types[count]);
+        ++count;
+    } else if (to_x < old.to_x) {
+        post_migration(slave, &slave->field, slave->halo + to_x + 1 - old.from_x,
+                       old.to_x - to_x, true, slave->neighbors[5], kMigrateRightTag,
+                       &requests[count], &types[count]);
+        ++count;
+    }
+    MPI_Waitall(count, requests, MPI_STATUSES_IGNORE);
+    for (int i = 0; i < count; ++i) {
+        MPI_Type_free(&types[i]);
+    }
+
+    destroy_field(&slave->field);
+    destroy_field(&slave->next_field);
+    slave->field = field;
+    init_field(&slave->next_field, field.width, field.height);
+    slave->block.from_x = from_x;
+    slave->block.to_x = to_x;
+    slave->width = to_x - from_x + 1;
+    destroy_buffers(slave);
+    init_buffers(slave);
+    if (slave->hashing) {
+        start_hashing_slave(slave);
+    }
+}
+
+/* Times kTuneGenerations generations in passes of every power of two
+ * depth up to `max_depth`, then puts the block back as it was. */
+static void tune_slave(slave_t* slave, int max_depth, double times[kMaxTuneDepths]) {
+    field_t backup;
+    init_field(&backup, slave->field.width, slave->field.height);
+    memcpy(backup.storage, slave->field.storage,
+           (size_t)(backup.width + 2) * backup.stride * sizeof(uint64_t));
+
+    for (int i = 0; i < kMaxTuneDepths && (1 << i) <= max_depth; ++i) {
+        MPI_Barrier(slave->grid);
+        double start = MPI_Wtime();
+        for (int gen = 0; gen < kTuneGenerations; gen += 1 << i) {
+            step_slave(slave, 1 << i);
+        }
+        times[i] = MPI_Wtime() - start;
+    }
+
+    memcpy(slave->field.storage, backup.storage,
+           (size_t)(backup.width + 2) * backup.stride * sizeof(uint64_t));
+    destroy_field(&backup);
+}
+
+static MPI_Offset get_snapshot_size(int width, int words) {
+    return sizeof(snapshot_header_t) + (MPI_Offset)width * words * sizeof(uint64_t);
+}
+
+/* Collective over the compute communicator. A new snapshot file is cut to
+ * `size` bytes. */
+static bool open_snapshot(const char* path, bool save, MPI_Offset size, MPI_File* file) {
+    int mode = save ? MPI_MODE_CREATE | MPI_MODE_WRONLY : MPI_MODE_RDONLY;
+    if (MPI_File_open(get_compute_comm(), path, mode, MPI_INFO_NULL, file) != MPI_SUCCESS) {
+        return false;
+    }
+    if (save) {
+        MPI_File_set_size(*file, size);
+    }
+    return true;
+}
+
+/* Bits of the last word past the block's last row hold halo rows; they go
+ * to the file as zeros and are exchanged again before they are read. */
+static void clear_block_tail(slave_t* slave) {
+    const uint64_t tail_mask = get_block_tail_mask(slave);
+    for (int x = 0; x < slave->width; ++x) {
+        get_column(&slave->field, slave->halo + x)[slave->words] &= tail_mask;
+    }
+}
+
+/* Every slave reads or writes its own block of the snapshot at once, the
+ * file seen through a view of just the block's words. */
+static void transfer_snapshot(slave_t* slave, MPI_File file, int header_size, bool save) {
+    int sizes[2] = {slave->board_width, slave->board_words};
+    int subsizes[2] = {slave->width, slave->words};
+    int starts[2] = {slave->block.from_x, slave->block.from_y / kCellsPerWord};
+    MPI_Datatype file_type;
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_UINT64_T, &file_type);
+    MPI_Type_commit(&file_type);
+    MPI_File_set_view(file, header_size, MPI_UINT64_T, file_type, "native", MPI_INFO_NULL);
+
+    MPI_Datatype block_type = make_block_type(&slave->field, slave->width, slave->words);
+    uint64_t* block = get_column(&slave->field, slave->halo) + 1;
+    if (save) {
+        clear_block_tail(slave);
+        MPI_File_write_all(file, block, 1, block_type, MPI_STATUS_IGNORE);
+    } else {
+        MPI_File_read_all(file, block, 1, block_type, MPI_STATUS_IGNORE);
+        clear_block_tail(slave);
+    }
+    MPI_Type_free(&block_type);
+    MPI_Type_free(&file_type);
+}
+
+static void slave_snapshot(slave_t* slave, int header_size, bool save) {
+    char path[kMaxPathLength];
+    MPI_Bcast(path, kMaxPathLength, MPI_CHAR, 0, get_compute_comm());
+    MPI_File file;
+    if (open_snapshot(path, save, get_snapshot_size(slave->board_width, slave->board_words),
+                      &file)) {
+        transfer_snapshot(slave, file, header_size, save);
+        MPI_File_close(&file);
+    }
+}
+
+void run_slave_loop() {
+    layout_t layout;
+    MPI_Recv(&layout, sizeof(layout_t) / sizeof(int), MPI_INT, get_master_rank(),
+             kInitialLayoutTag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    /* The rule may come from the pattern, which only the master reads. */
+    options.rule = layout.rule;
+    setup_rule();
+
+    slave_t slave;
+    init_slave(&slave, &layout);
+    recv_block(&slave.field, slave.halo, slave.width, 1, slave.words, slave.transfer,
+               get_master_rank(), kInitialDataTag, MPI_COMM_WORLD);
+    join_grid(&slave, &layout);
+    MPI_Comm comm = get_compute_comm();
+    int* bounds = malloc((slave.grid_width + 1) * sizeof(int));
+
+    bool halt_required = false;
+    while (!halt_required) {
+        int cmd[2];
+        MPI_Bcast(cmd, 2, MPI_INT, 0, comm);
+        switch (cmd[0]) {
+            case kStepCmd: {
+                double ack[kAckValues];
+                const double busy = step_slave(&slave, cmd[1]);
+                make_ack(busy, get_slave_hash(&slave), ack);
+                MPI_Gather(ack, kAckValues, MPI_DOUBLE, NULL, kAckValues, MPI_DOUBLE, 0, comm);
+                break;
+            }
+            case kHashCmd:
+                if (cmd[1]) {
+                    start_hashing_slave(&slave);
+                    uint64_t hash = get_slave_hash(&slave);
+                    MPI_Reduce(&hash, NULL, 1, MPI_UINT64_T, MPI_SUM, 0, comm);
+                } else {
+                    stop_hashing_slave(&slave);
+                }
+                break;
+            case kGatherCmd:
+                send_block(&slave.field, slave.halo, slave.width, 1, slave.words,
+                           slave.transfer, 0, kGatherTag, comm);
+                break;
+            case kTuneCmd: {
+                /* The master gets the slowest slave's times. */
+                double times[kMaxTuneDepths] = {0};
+                tune_slave(&slave, cmd[1], times);
+                MPI_Reduce(times, NULL, kMaxTuneDepths, MPI_DOUBLE, MPI_MAX, 0, comm);
+                break;
+            }
+            case kRebalanceCmd:
+                MPI_Bcast(bounds, slave.grid_width + 1, MPI_INT, 0, comm);
+                rebalance_slave(&slave, bounds);
+                break;
+            case kSaveCmd:
+            case kLoadCmd:
+                slave_snapshot(&slave, cmd[1], cmd[0] == kSaveCmd);
+                break;
+            case kHaltCmd:
+                halt_required = true;
+                break;
+        }
+    }
+
+    free(bounds);
+    destroy_slave(&slave);
+    MPI_Comm_free(&compute_comm);
+}
+
+/* Commands travel from the I/O side to the master as a letter and, for
+ * `run` and `run-until-stable`, a number of generations or, for `save` and
+ * `load`, a file name;
+ * the sender waits until the master is done with one. The I/O rank sends
+ * them as messages, the I/O thread of the hybrid build hands them over in
+ * memory. */
+#ifdef _OPENMP
+static struct {
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+    char cmd;   /* 0 - nothing pending */
+    int arg;
+    const char* path;
+} channel = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, NULL};
+
+static void send_command(char cmd, int arg, const char* path) {
+    pthread_mutex_lock(&channel.mtx);
+    channel.cmd = cmd;
+    channel.arg = arg;
+    channel.path = path;
+    pthread_cond_broadcast(&channel.cv);
+    while (channel.cmd != 0) {
+        pthread_cond_wait(&channel.cv, &channel.mtx);
+    }
+    pthread_mutex_unlock(&channel.mtx);
+}
+
+static bool receive_command(bool wait, char* cmd, int* arg, char path[kMaxPathLength]) {
+    pthread_mutex_lock(&channel.mtx);
+    while (wait && channel.cmd == 0) {
+        pthread_cond_wait(&channel.cv, &channel.mtx);
+    }
+    bool received = channel.cmd != 0;
+    *cmd = channel.cmd;
+    *arg = channel.arg;
+    if (received && channel.path != NULL) {
+        strcpy(path, channel.path);
+    }
+    pthread_mutex_unlock(&channel.mtx);
+    return received;
+}
+
+static void complete_command() {
+    pthread_mutex_lock(&channel.mtx);
+    channel.cmd = 0;
+    pthread_cond_broadcast(&channel.cv);
+    pthread_mutex_unlock(&channel.mtx);
+}
+#else
+static void send_command(char cmd, int arg, const char* path) {
+    MPI_Send(&cmd, 1, MPI_BYTE, get_master_rank(), kCmdTag, MPI_COMM_WORLD);
+    if (cmd == 'R' || cmd == 'U') {
+        MPI_Send(&arg, 1, MPI_INT, get_master_rank(), kDataTag, MPI_COMM_WORLD);
+    }
+    if (path != NULL) {
+        MPI_Send(path, strlen(path) + 1, MPI_CHAR, get_master_rank(), kDataTag, MPI_COMM_WORLD);
+    }
+    MPI_Recv(&cmd, 1, MPI_BYTE, get_master_rank(), kCmdTag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+}
+
+static char pending_cmd;
+static MPI_Request cmd_request = MPI_REQUEST_NULL;
+
+static bool receive_command(bool wait, char* cmd, int* arg, char path[kMaxPathLength]) {
+    if (cmd_request == MPI_REQUEST_NULL) {
+        MPI_Irecv(&pending_cmd, 1, MPI_BYTE, get_io_rank(), kCmdTag, MPI_COMM_WORLD,
+                  &cmd_request);
+    }
+    int flag = 1;
+    if (wait) {
+        MPI_Wait(&cmd_request, MPI_STATUS_IGNORE);
+    } else {
+        MPI_Test(&cmd_request, &flag, MPI_STATUS_IGNORE);
+    }
+    if (!flag) {
+        return false;
+    }
+    *cmd = pending_cmd;
+    if (*cmd == 'R' || *cmd == 'U') {
+        MPI_Recv(arg, 1, MPI_INT, get_io_rank(), kDataTag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+    if (*cmd == 'W' || *cmd == 'L') {
+        MPI_Recv(path, kMaxPathLength, MPI_CHAR, get_io_rank(), kDataTag, MPI_COMM_WORLD,
+                 MPI_STATUS_IGNORE);
+    }
+    return true;
+}
+
+static void complete_command() {
+    char ack = 1;
+    MPI_Send(&ack, 1, MPI_BYTE, get_io_rank(), kCmdTag, MPI_COMM_WORLD);
+}
+#endif
+
+static void broadcast_cmd(int cmd, int arg) {
+    int message[2] = {cmd, arg};
+    MPI_Bcast(message, 2, MPI_INT, 0, get_compute_comm());
+}
+
+/* One exchange and up to `depth` generations on every slave; returns once
+ * all of them are done. */
+static void master_step(struct workers_internal* data) {
+    const long long start = get_time_ns();
+    int gens = min(data->detecting ? 1 : data->depth, data->req_gen - data->cur_gen);
+    broadcast_cmd(kStepCmd, gens);
+    double busy = 0;
+    uint64_t hash = 0;
+#ifdef _OPENMP
+    busy = step_slave(&data->slave, gens);
+    hash = get_slave_hash(&data->slave);
+#endif
+    double ack[kAckValues];
+    make_ack(busy, hash, ack);
+    MPI_Gather(ack, kAckValues, MPI_DOUBLE, data->acks, kAckValues, MPI_DOUBLE, 0,
+               get_compute_comm());
+    for (int i = 0; i < data->blocks_cnt; ++i) {
+        data->costs[i] += data->acks[get_compute_rank(i) * kAckValues + kAckBusy];
+    }
+    data->cur_gen += gens;
+
+    int ranks;
+    MPI_Comm_size(get_compute_comm(), &ranks);
+    stats_t* stats = &data->stats;
+    data->hash = 0;
+    for (int i = 0; i < ranks; ++i) {
+        const double* rank_ack = &data->acks[i * kAckValues];
+        stats->busy_ns += (long long)(rank_ack[kAckBusy] * 1e9);
+        stats->wait_ns += (long long)(rank_ack[kAckWaited] * 1e9);
+        stats->messages += (long long)rank_ack[kAckMessages];
+        stats->bytes += (long long)rank_ack[kAckBytes];
+        data->hash += (uint64_t)rank_ack[kAckHashLow] | (uint64_t)rank_ack[kAckHashHigh] << 32;
+    }
+    const long long pass_ns = get_time_ns() - start;
+    ++stats->passes;
+    stats->pass_ns += pass_ns;
+    stats->max_pass_ns = pass_ns > stats->max_pass_ns ? pass_ns : stats->max_pass_ns;
+    stats->generation = data->cur_gen;
+    if (is_trace_due()) {
+        write_trace(stats);
+    }
+}
+
+/* Cumulative cost of the board's first `x` columns, taking the cost of a
+ * column of blocks as spread evenly over its columns. */
+static double get_cost_before(const int* bounds, const double* costs, int columns, int x) {
+    double cost = 0;
+    for (int c = 0; c < columns && bounds[c] < x; ++c) {
+        const int width = bounds[c + 1] - bounds[c];
+        cost += costs[c] * (min(x, bounds[c + 1]) - bounds[c]) / width;
+    }
+    return cost;
+}
+
+/* New borders split the board into equal costs, are kept at least `depth`
+ * columns apart so that halos still come from a single neighbor, and move
+ * no further than the borders next to them. Returns whether any moved. */
+static bool choose_bounds(const struct workers_internal* data, const double* costs,
+                          const int* bounds, int* new_bounds) {
+    const int columns = data->grid_width, width = data->field->width;
+    double total = 0;
+    for (int c = 0; c < columns; ++c) {
+        total += costs[c];
+    }
+
+    new_bounds[0] = 0;
+    new_bounds[columns] = width;
+    bool moved = false;
+    for (int c = 1; c < columns; ++c) {
+        /* The first column where the cumulative cost reaches c / columns of
+         * the total, by bisection. */
+        const double target = total * c / columns;
+        int lo = bounds[c - 1], hi = bounds[c + 1];
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (get_cost_before(bounds, costs, columns, mid) < target) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        lo = max(lo, max(bounds[c - 1], new_bounds[c - 1] + data->depth));
+        new_bounds[c] = min(lo, min(bounds[c + 1], width - (columns - c) * data->depth));
+        moved = moved || new_bounds[c] != bounds[c];
+    }
+    return moved;
+}
+
+/* A column of blocks costs as much as its slowest block. Borders are only
+ * redrawn when the same column has been kRebalanceThreshold behind the
+ * average for kRebalanceWindows windows. */
+static void master_rebalance(struct workers_internal* data) {
+    const int columns = data->grid_width, rows = data->grid_height;
+    double* costs = calloc(columns, sizeof(double));
+    int* bounds = malloc((columns + 1) * sizeof(int));
+    int* new_bounds = malloc((columns + 1) * sizeof(int));
+    double total = 0;
+    int slowest = 0;
+    for (int c = 0; c < columns; ++c) {
+        for (int r = 0; r < rows; ++r) {
+            if (data->costs[c * rows + r] > costs[c]) {
+                costs[c] = data->costs[c * rows + r];
             }
-            printf("%c", ch);
         }
-        printf("\n");
+        total += costs[c];
+        if (costs[c] > costs[slowest]) {
+            slowest = c;
+        }
+        bounds[c] = data->blocks[c * rows].from_x;
+    }
+    bounds[columns] = data->field->width;
+    memset(data->costs, 0, data->blocks_cnt * sizeof(double));
+    data->balanced_gen = data->cur_gen;
+
+    if (columns > 1 && costs[slowest] > (1 + kRebalanceThreshold) * total / columns) {
+        data->slow_windows = slowest == data->slow_column ? data->slow_windows + 1 : 1;
+        data->slow_column = slowest;
+    } else {
+        data->slow_windows = 0;
+        data->slow_column = -1;
+    }
+
+    if (data->slow_windows >= kRebalanceWindows && choose_bounds(data, costs, bounds, new_bounds)) {
+        data->slow_windows = 0;
+        data->slow_column = -1;
+        broadcast_cmd(kRebalanceCmd, 0);
+        MPI_Bcast(new_bounds, columns + 1, MPI_INT, 0, get_compute_comm());
+#ifdef _OPENMP
+        rebalance_slave(&data->slave, new_bounds);
+#endif
+        for (int i = 0; i < data->blocks_cnt; ++i) {
+            data->blocks[i].from_x = new_bounds[i / rows];
+            data->blocks[i].to_x = new_bounds[i / rows + 1] - 1;
+        }
+        reserve_transfer(data);
+    }
+
+    free(new_bounds);
+    free(bounds);
+    free(costs);
+}
+
+static void master_tune(struct workers_internal* data) {
+    broadcast_cmd(kTuneCmd, data->max_depth);
+    double times[kMaxTuneDepths] = {0};
+    double slave_times[kMaxTuneDepths] = {0};
+#ifdef _OPENMP
+    tune_slave(&data->slave, data->max_depth, slave_times);
+#endif
+    MPI_Reduce(slave_times, times, kMaxTuneDepths, MPI_DOUBLE, MPI_MAX, 0, get_compute_comm());
+    /* --bench prints nothing but its JSON line. */
+    const bool report = options.bench == kBenchNone;
+    int best = 0;
+    for (int i = 0; i < kMaxTuneDepths && (1 << i) <= data->max_depth; ++i) {
+        if (report) {
+            printf("# Halo %2d: %.3f ms per generation\n", 1 << i,
+                   times[i] * 1000 / kTuneGenerations);
+        }
+        if (times[i] < times[best]) {
+            best = i;
+        }
+    }
+    data->depth = 1 << best;
+    if (report) {
+        printf("# Halo depth: %d\n", data->depth);
+        fflush(stdout);
+    }
+}
+
+static void master_gather(struct workers_internal* data) {
+    if (data->gathered_gen == data->cur_gen) {
+        return;
+    }
+    broadcast_cmd(kGatherCmd, 0);
+    field_t* field = data->field;
+    for (int i = 0; i < data->blocks_cnt; ++i) {
+        const block_t* block = &data->blocks[i];
+#ifdef _OPENMP
+        if (i == 0) {
+            const slave_t* slave = &data->slave;
+            copy_block(&slave->field, slave->halo, 1, field, block->from_x,
+                       block->from_y / kCellsPerWord, slave->width, slave->words);
+            continue;
+        }
+#endif
+        recv_block(field, block->from_x, block->to_x - block->from_x + 1,
+                   block->from_y / kCellsPerWord, get_block_words(block), data->transfer,
+                   get_compute_rank(i), kGatherTag, get_compute_comm());
+    }
+    /* The last words came with halo rows of the slaves below the board. */
+    const uint64_t tail_mask = get_tail_mask(field);
+    for (int x = 0; x < field->width; ++x) {
+        get_column(field, x)[field->words - 1] &= tail_mask;
     }
+    refresh_halo(field);
+    data->gathered_gen = data->cur_gen;
 }
 
-static void master_run(struct workers_internal* data) {
-    int n;
-    MPI_Recv(&n, 1, MPI_INT, get_io_rank(), kDataTag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-    data->req_gen += n;
+static void record_snapshot(struct workers_internal* data, long long start) {
+    ++data->stats.snapshots;
+    data->stats.snapshot_ns += get_time_ns() - start;
+}
+
+static void master_dump_field(struct workers_internal* data) {
+    const long long start = get_time_ns();
+    master_gather(data);
+    record_snapshot(data, start);
+    print_field(data->field, data->cur_gen);
+    fflush(stdout);
+}
+
+/* Traffic of the last gathers and of the master's own sends is only
+ * reported by the next step. */
+static void master_dump_stats(struct workers_internal* data) {
+    data->stats.generation = data->cur_gen;
+    print_stats(&data->stats);
+    fflush(stdout);
+}
+
+static void master_run(struct workers_internal* data, int n) {
+    /* An unlimited run-until-stable already asks for INT_MAX. */
+    data->req_gen += min(n, INT_MAX - data->req_gen);
 }
 
 static void master_stop(struct workers_internal* data) {
     data->req_gen = min(data->req_gen, data->cur_gen + 1);
 }
 
-void run_master_loop(struct workers_internal* data) {
-    LOG;
-    int stop_required = 0;
+/* Replaces the run in progress with up to `limit` generations, or as many
+ * as it takes if it is 0. The blocks' hashes are summed once here; after
+ * that every step's acks carry them. */
+static void master_start_stable(struct workers_internal* data, int limit) {
+    broadcast_cmd(kHashCmd, 1);
+    uint64_t hash = 0;
+#ifdef _OPENMP
+    start_hashing_slave(&data->slave);
+    hash = get_slave_hash(&data->slave);
+#endif
+    MPI_Reduce(&hash, &data->hash, 1, MPI_UINT64_T, MPI_SUM, 0, get_compute_comm());
+
+    if (data->detecting) {
+        destroy_cycle_detector(&data->detector);
+    }
+    init_cycle_detector(&data->detector);
+    detect_cycle(&data->detector, data->hash);
+    data->req_gen = data->cur_gen + min(limit > 0 ? limit : INT_MAX, INT_MAX - data->cur_gen);
+    data->detecting = true;
+}
 
-    int responses_left = 0;
-    char cmd;
+/* Ends the run and prints the outcome; period 0 if the run ran out first. */
+static void master_finish_stable(struct workers_internal* data, int period) {
+    broadcast_cmd(kHashCmd, 0);
+#ifdef _OPENMP
+    stop_hashing_slave(&data->slave);
+#endif
+    print_cycle(data->cur_gen, period);
+    data->req_gen = data->cur_gen;
+    data->detecting = false;
+    destroy_cycle_detector(&data->detector);
+}
 
-//    MPI_Status status;
-    int flag;
+/* The master writes the header; the blocks are written by the slaves that
+ * hold them. */
+static bool master_open_snapshot(struct workers_internal* data, const char* path,
+                                 int header_size, bool save, MPI_File* file) {
+    broadcast_cmd(save ? kSaveCmd : kLoadCmd, header_size);
+    char buffer[kMaxPathLength];
+    snprintf(buffer, sizeof buffer, "%s", path);
+    MPI_Bcast(buffer, kMaxPathLength, MPI_CHAR, 0, get_compute_comm());
+    if (!open_snapshot(path, save, get_snapshot_size(data->field->width, data->field->words),
+                       file)) {
+        printf("# Cannot open %s\n", path);
+        fflush(stdout);
+        return false;
+    }
+    return true;
+}
 
-    MPI_Request cmd_request;
-    MPI_Request* slave_request = calloc(data->ranges_cnt, sizeof(MPI_Request));
+static void master_transfer_snapshot(struct workers_internal* data, MPI_File file,
+                                     int header_size, bool save) {
+#ifdef _OPENMP
+    transfer_snapshot(&data->slave, file, header_size, save);
+#else
+    /* The view and the transfer are collective, the master moves nothing. */
+    MPI_File_set_view(file, header_size, MPI_UINT64_T, MPI_UINT64_T, "native", MPI_INFO_NULL);
+    if (save) {
+        MPI_File_write_all(file, NULL, 0, MPI_UINT64_T, MPI_STATUS_IGNORE);
+    } else {
+        MPI_File_read_all(file, NULL, 0, MPI_UINT64_T, MPI_STATUS_IGNORE);
+    }
+#endif
+    MPI_File_close(&file);
+}
 
-    MPI_Irecv(&cmd, 1, MPI_BYTE, get_io_rank(), kCmdTag, MPI_COMM_WORLD, &cmd_request);
-    for (int i = 0; i < data->ranges_cnt; ++i) {
-        MPI_Irecv(get_cell(data->next_field, data->ranges[i].from, 0),
-                  (data->ranges[i].to - data->ranges[i].from + 1) *
-                  data->field->height, MPI_INT, get_slave_rank(i), kDataTag,
-                  MPI_COMM_WORLD, &slave_request[i]);
+static void master_save(struct workers_internal* data, const char* path) {
+    const long long start = get_time_ns();
+    snapshot_header_t header;
+    make_snapshot_header(&header, data->field, data->cur_gen);
+    MPI_File file;
+    if (master_open_snapshot(data, path, header.header_size, true, &file)) {
+        MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+        master_transfer_snapshot(data, file, header.header_size, true);
+        record_snapshot(data, start);
     }
+}
 
-    while (!(stop_required && responses_left == 0)) {
-        flag = 0;
-        MPI_Test(&cmd_request, &flag, MPI_STATUS_IGNORE);
-        if (flag) {
+/* Stops the run at the snapshot's generation. */
+static void master_load(struct workers_internal* data, const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("# %s\n", strerror(errno));
+        fflush(stdout);
+        return;
+    }
+    snapshot_header_t header;
+    bool has_header = fread(&header, sizeof(header), 1, f) == 1;
+    fseek(f, 0, SEEK_END);
+    long file_size = ftell(f);
+    fclose(f);
+    const char* err_msg = has_header ? check_snapshot_header(&header, data->field, file_size)
+                                     : "Ill-formed snapshot file";
+    if (err_msg != NULL) {
+        printf("# %s\n", err_msg);
+        fflush(stdout);
+        return;
+    }
+
+    MPI_File file;
+    if (master_open_snapshot(data, path, header.header_size, false, &file)) {
+        master_transfer_snapshot(data, file, header.header_size, false);
+        data->cur_gen = data->req_gen = data->balanced_gen = (int)header.generation;
+        data->gathered_gen = -1;
+    }
+}
+
+void run_master_loop(struct workers_internal* data) {
+    if (data->depth == 0) {
+        master_tune(data);
+    }
+
+    bool halt_required = false;
+    /* `F` is only acknowledged once the generations asked for are done. */
+    bool finish_pending = false;
+    while (!halt_required) {
+        /* Commands are looked at between generations; with nothing to
+         * compute the master just waits for the next one. */
+        char cmd;
+        int arg;
+        char path[kMaxPathLength];
+        const bool idle = data->cur_gen >= data->req_gen;
+        const long long idle_start = get_time_ns();
+        if (!finish_pending && receive_command(idle, &cmd, &arg, path)) {
+            if (idle) {
+                data->stats.idle_ns += (get_time_ns() - idle_start) * data->blocks_cnt;
+            }
             switch (cmd) {
                 case 'D': /* Dump */
                     master_dump_field(data);
                     break;
+                case 'T': /* Print stats */
+                    master_dump_stats(data);
+                    break;
                 case 'R': /* Run */
-                    master_run(data);
+                    master_run(data, arg);
+                    break;
+                case 'W': /* Write a snapshot */
+                    master_save(data, path);
+                    break;
+                case 'L': /* Load a snapshot */
+                    master_load(data, path);
                     break;
                 case 'S': /* Stop */
                     master_stop(data);
                     break;
+                case 'F': /* Finish */
+                    finish_pending = true;
+                    break;
+                case 'U': /* Run until stable */
+                    master_start_stable(data, arg);
+                    break;
                 case 'H': /* Halt */
-                    stop_required = 1;
+                    halt_required = true;
                     break;
             }
-            MPI_Send(&flag, 1, MPI_BYTE, get_io_rank(), kCmdTag, MPI_COMM_WORLD);
-            MPI_Irecv(&cmd, 1, MPI_BYTE, get_io_rank(), kCmdTag, MPI_COMM_WORLD, &cmd_request);
-        }
-
-        if (responses_left == 0 && !stop_required && data->cur_gen < data->req_gen) {
-            LOG;
-            responses_left = data->ranges_cnt;
-
-            field_t* temp = data->field;
-            data->field = data->next_field;
-            data->next_field = temp;
-            ++data->cur_gen;
-
-            int false_flag = 0;
-            for (int i = 0; i < data->ranges_cnt; ++i) {
-                MPI_Send(&false_flag, 1, MPI_INT, get_slave_rank(i),
-                         kStopRequiredTag, MPI_COMM_WORLD);
-
-                int left_x = (data->ranges[i].from - 1 + data->field->width) %
-                             data->field->width;
-                MPI_Send(get_cell(data->field, left_x, 0), data->field->height, MPI_INT,
-                        get_slave_rank(i), kDataTag, MPI_COMM_WORLD);
-
-                int right_x = (data->ranges[i].to + 1 + data->field->width) %
-                             data->field->width;
-                MPI_Send(get_cell(data->field, right_x, 0), data->field->height, MPI_INT,
-                        get_slave_rank(i), kDataTag, MPI_COMM_WORLD);
+            if (!finish_pending) {
+                complete_command();
             }
         }
 
-        for (int i = 0; i < data->ranges_cnt; ++i) {
-            flag = 0;
-            DEBUG("%p", get_cell(data->field, data->ranges[i].from, 0));
-            MPI_Test(&slave_request[i], &flag, MPI_STATUS_IGNORE);
-            if (flag) {
-                --responses_left;
-                if (!stop_required) {
-                    LOG;
-                    DEBUG("%p", get_cell(data->field, data->ranges[i].from, 0));
-                    MPI_Irecv(get_cell(data->field, data->ranges[i].from, 0),
-                              (data->ranges[i].to - data->ranges[i].from + 1) *
-                              data->field->height, MPI_INT, get_slave_rank(i), kDataTag,
-                              MPI_COMM_WORLD, &slave_request[i]);
-                    LOG;
+        if (!halt_required && data->cur_gen < data->req_gen) {
+            master_step(data);
+            if (data->detecting) {
+                const int period = detect_cycle(&data->detector, data->hash);
+                if (period > 0) {
+                    master_finish_stable(data, period);
                 }
             }
+            if (data->cur_gen - data->balanced_gen >= kRebalanceGenerations) {
+                master_rebalance(data);
+            }
+        }
+        /* The limit is reached, or `stop` or `load` cut the run short. */
+        if (!halt_required && data->detecting && data->cur_gen >= data->req_gen) {
+            master_finish_stable(data, 0);
+        }
+        if (finish_pending && data->cur_gen >= data->req_gen) {
+            finish_pending = false;
+            complete_command();
         }
     }
-    free(slave_request);
 }
 
 void run_controller_loop(field_t* field, workers_t* workers) {
@@ -277,44 +1648,75 @@ void run_controller_loop(field_t* field, workers_t* workers) {
 }
 
 void destroy_workers(workers_t* workers) {
-    int num_of_slaves = get_slaves_count();
-    int stop = 1;
-    for (int i = 0; i < num_of_slaves; ++i) {
-        MPI_Send(&stop, 1, MPI_INT, get_slave_rank(i), kStopRequiredTag, MPI_COMM_WORLD);
-    }
+    broadcast_cmd(kHaltCmd, 0);
+#ifdef _OPENMP
+    destroy_slave(&workers->impl->slave);
+#endif
+    MPI_Comm_free(&compute_comm);
 
-    destroy_field(&second_field);
-    free(workers->impl->ranges);
+    if (workers->impl->detecting) {
+        destroy_cycle_detector(&workers->impl->detector);
+    }
+    free(workers->impl->acks);
+    free(workers->impl->costs);
+    free(workers->impl->blocks);
+    free(workers->impl->transfer);
     free(workers->impl);
 }
 
-static void send_command(char cmd, int arg) {
-    LOG;
-    MPI_Send(&cmd, 1, MPI_BYTE, get_master_rank(), kCmdTag, MPI_COMM_WORLD);
-    if (cmd == 'R') {
-        MPI_Send(&arg, 1, MPI_INT, get_master_rank(), kDataTag, MPI_COMM_WORLD);
+
+void dump_field(field_t* field, workers_t* workers) {
+    send_command('D', 0, NULL);
+}
+
+void dump_stats(field_t* field, workers_t* workers) {
+    send_command('T', 0, NULL);
+}
+
+void save_field(field_t* field, workers_t* workers) {
+    char path[kMaxPathLength];
+    if (!scan_path(path)) {
+        return;
     }
-    LOG;
-    MPI_Recv(&cmd, 1, MPI_BYTE, get_master_rank(), kCmdTag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    send_command('W', 0, path);
 }
 
-void dump_field(field_t* field, workers_t* workers) {
-    send_command('D', 0);
+void load_field(field_t* field, workers_t* workers) {
+    char path[kMaxPathLength];
+    if (!scan_path(path)) {
+        return;
+    }
+    send_command('L', 0, path);
 }
 
 void run(field_t* field, workers_t* workers) {
-    int n;
-    if (scanf("%d", &n) != 1 || n <= 0) {
-        printf("# A positive integer required!\n");
+    int n = 0;
+    if (!scan_count(&n)) {
         return;
     }
-    send_command('R', n);
+    run_generations(workers, n);
+}
+
+void run_until_stable(field_t* field, workers_t* workers) {
+    int limit = 0;
+    if (!scan_limit(&limit)) {
+        return;
+    }
+    send_command('U', limit, NULL);
+}
+
+void run_generations(workers_t* workers, int n) {
+    send_command('R', n, NULL);
+}
+
+void finish_generations(workers_t* workers) {
+    send_command('F', 0, NULL);
 }
 
 void stop(field_t* field, workers_t* workers) {
-    send_command('S', 0);
+    send_command('S', 0, NULL);
 }
 
 void stop_emulation(workers_t* workers) {
-    send_command('H', 0);
+    send_command('H', 0, NULL);
 }
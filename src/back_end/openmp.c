@@ -1,6 +1,9 @@
 #include <interface.h>
+#include <kernel.h>
+#include <limits.h>
 #include <omp.h>
-#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -18,9 +21,35 @@ struct workers_internal {
     int required_gen;
     int current_gen;
     bool stop_requested;
+    /* Set while a pass reads and writes the fields. */
+    bool computing;
+    /* Added to generation numbers shown to the user, see load_field. */
+    int gen_shift;
+    /* Bumped under mtx_gen whenever `field` changes, see take_snapshot. */
+    atomic_int epoch;
+    field_t snapshot;
 
-    omp_lock_t cur_gen_lock;
-//    omp_lock_t req_gen_lock;
+    tiling_t tiling;
+    int threads;
+    tile_scratch_t* scratch;
+    activity_t activity;
+    /* Time every thread spent on its share of the passes. */
+    atomic_llong* busy_ns;
+    /* Pass, idle and snapshot counters, under mtx_gen; idle time is added
+     * once the wait that began at idle_since_ns is over. */
+    stats_t stats;
+    long long idle_since_ns;
+    /* run-until-stable: picked up by start_pass, then every generation
+     * published is checked for a repeat until the run ends. */
+    stable_state_t stable_state;
+    int stable_limit;
+    cycle_detector_t detector;
+
+    /* Guards the fields above. The controller sleeps on cv_req_gen while
+     * no generations are required, the commands sleep on it while a pass
+     * is in flight. */
+    pthread_cond_t  cv_req_gen;
+    pthread_mutex_t mtx_gen;
 };
 
 static field_t second_field;
@@ -35,102 +64,308 @@ const char* setup_workers(field_t* field, workers_t* workers) {
     workers->impl->required_gen = 0;
     workers->impl->current_gen = 0;
     workers->impl->stop_requested = false;
+    workers->impl->computing = false;
+    workers->impl->gen_shift = 0;
+    workers->impl->stable_state = kStableOff;
+    atomic_init(&workers->impl->epoch, 0);
+    init_field(&workers->impl->snapshot, field->width, field->height);
+
+    workers->impl->tiling = make_tiling(field);
+    init_activity(&workers->impl->activity, &workers->impl->tiling);
+    /* OMP_SCHEDULE picks the schedule of the generation loop. Static is the
+     * one that keeps tiles on the threads that first touched them. */
+    if (getenv("OMP_SCHEDULE") == NULL) {
+        omp_set_schedule(omp_sched_static, 0);
+    }
+    workers->impl->threads = omp_get_max_threads();
+    workers->impl->scratch = calloc(workers->impl->threads, sizeof(tile_scratch_t));
+    #pragma omp parallel num_threads(workers->impl->threads)
+    init_tile_scratch(&workers->impl->scratch[omp_get_thread_num()], &workers->impl->tiling);
+    workers->impl->busy_ns = calloc(workers->impl->threads, sizeof(atomic_llong));
 
-    omp_init_lock(&workers->impl->cur_gen_lock);
-//    omp_init_lock(&workers->impl->req_gen_lock);
+    pthread_cond_init(&workers->impl->cv_req_gen, NULL);
+    pthread_mutex_init(&workers->impl->mtx_gen, NULL);
 
     return NULL;
 }
 
 void destroy_workers(workers_t* workers) {
+    for (int i = 0; i < workers->impl->threads; ++i) {
+        destroy_tile_scratch(&workers->impl->scratch[i]);
+    }
+    free(workers->impl->scratch);
+    free(workers->impl->busy_ns);
+    if (workers->impl->stable_state != kStableOff) {
+        destroy_cycle_detector(&workers->impl->detector);
+    }
+    destroy_activity(&workers->impl->activity);
     destroy_field(&second_field);
-    omp_destroy_lock(&workers->impl->cur_gen_lock);
-//    omp_destroy_lock(&workers->impl->req_gen_lock);
+    destroy_field(&workers->impl->snapshot);
+    pthread_mutex_destroy(&workers->impl->mtx_gen);
+    pthread_cond_destroy(&workers->impl->cv_req_gen);
     free(workers->impl);
 }
 
+/* Copies the latest generation to data->snapshot and returns its number.
+ * The published field is only written by the pass after the next one, so
+ * the copy is taken without mtx_gen; only the last try holds the lock. */
+static int take_snapshot(struct workers_internal* data) {
+    const long long start = get_time_ns();
+    int gen = 0;
+    const bool copied = copy_published_field(&data->snapshot, &data->field, &data->current_gen,
+                                             &data->gen_shift, &data->epoch, &data->mtx_gen,
+                                             &gen);
+    pthread_mutex_lock(&data->mtx_gen);
+    if (!copied) {
+        copy_field(&data->snapshot, data->field);
+        gen = data->current_gen + data->gen_shift;
+    }
+    ++data->stats.snapshots;
+    data->stats.snapshot_ns += get_time_ns() - start;
+    pthread_mutex_unlock(&data->mtx_gen);
+    return gen;
+}
+
 void dump_field(field_t* field, workers_t* workers) {
-    omp_set_lock(&workers->impl->cur_gen_lock);
-
-    printf("# Current iteration: %d\n", workers->impl->current_gen);
-    for (int y = 0; y < field->height; ++y) {
-        printf("# ");
-        for (int x = 0; x < field->width; ++x) {
-            char ch = '_';
-            if (*get_cell(workers->impl->field, x, y)) {
-                ch = 'O';
-            }
-            printf("%c", ch);
-        }
-        printf("\n");
+    int gen = take_snapshot(workers->impl);
+    print_field(&workers->impl->snapshot, gen);
+}
+
+/* Called with mtx_gen held. Threads done with their share of a pass wait
+ * for the rest at the end of the parallel region. */
+static void collect_stats(struct workers_internal* data, stats_t* stats) {
+    *stats = data->stats;
+    stats->generation = data->current_gen + data->gen_shift;
+    stats->workers = data->threads;
+    if (data->idle_since_ns > 0) {
+        stats->idle_ns += (get_time_ns() - data->idle_since_ns) * data->threads;
     }
+    for (int i = 0; i < data->threads; ++i) {
+        stats->busy_ns += atomic_load_explicit(&data->busy_ns[i], memory_order_relaxed);
+    }
+    stats->wait_ns = data->threads * stats->pass_ns - stats->busy_ns;
+    stats->wait_ns = stats->wait_ns < 0 ? 0 : stats->wait_ns;
+}
 
-    omp_unset_lock(&workers->impl->cur_gen_lock);
+void dump_stats(field_t* field, workers_t* workers) {
+    stats_t stats;
+    pthread_mutex_lock(&workers->impl->mtx_gen);
+    collect_stats(workers->impl, &stats);
+    pthread_mutex_unlock(&workers->impl->mtx_gen);
+    print_stats(&stats);
+}
+
+void save_field(field_t* field, workers_t* workers) {
+    char path[kMaxPathLength];
+    if (!scan_path(path)) {
+        return;
+    }
+
+    int gen = take_snapshot(workers->impl);
+    const char* err_msg = save_snapshot(path, &workers->impl->snapshot, gen);
+    if (err_msg != NULL) {
+        printf("# %s\n", err_msg);
+    }
+}
+
+/* Ends a run-until-stable with no cycle found, whether the controller has
+ * picked it up or not. Called with mtx_gen held and no pass in flight
+ * unless the run-until-stable is only requested. */
+static void end_stable_run(struct workers_internal* data) {
+    if (data->stable_state == kStableOff) {
+        return;
+    }
+    if (data->stable_state == kStableDetecting) {
+        stop_hashing(&data->activity);
+    }
+    destroy_cycle_detector(&data->detector);
+    data->stable_state = kStableOff;
+    print_cycle(data->current_gen + data->gen_shift, 0);
+}
+
+/* Stops the run and overwrites the board once the pass in flight, if any,
+ * is published. The generation counter keeps running and is shown shifted
+ * to the snapshot's. */
+void load_field(field_t* field, workers_t* workers) {
+    char path[kMaxPathLength];
+    if (!scan_path(path)) {
+        return;
+    }
+
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_gen);
+    data->required_gen = data->current_gen;
+    while (data->computing) {
+        pthread_cond_wait(&data->cv_req_gen, &data->mtx_gen);
+    }
+    end_stable_run(data);
+    long long gen = 0;
+    const char* err_msg = load_snapshot(path, data->field, &gen);
+    if (err_msg == NULL) {
+        atomic_fetch_add(&data->epoch, 1);
+        reset_activity(&data->activity, &data->tiling);
+        data->gen_shift = (int)gen - data->current_gen;
+    }
+    pthread_mutex_unlock(&data->mtx_gen);
+
+    if (err_msg != NULL) {
+        printf("# %s\n", err_msg);
+    }
 }
 
 void run(field_t* field, workers_t* workers) {
     int n = 0;
-    if (scanf("%d", &n) != 1 || n <= 0) {
-        printf("# A positive integer expected!\n");
+    if (!scan_count(&n)) {
+        return;
+    }
+
+    run_generations(workers, n);
+}
+
+/* Replaces whatever run is in progress, be it a run-until-stable too. The
+ * outcome is printed once the run ends. */
+void run_until_stable(field_t* field, workers_t* workers) {
+    int limit = 0;
+    if (!scan_limit(&limit)) {
         return;
     }
 
-    #pragma omp critical
-    workers->impl->required_gen += n;
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_gen);
+    if (data->stable_state != kStableOff) {
+        destroy_cycle_detector(&data->detector);
+    }
+    init_cycle_detector(&data->detector);
+    data->stable_limit = limit > 0 ? limit : INT_MAX;
+    data->stable_state = kStableRequested;
+    pthread_cond_broadcast(&data->cv_req_gen);
+    pthread_mutex_unlock(&data->mtx_gen);
+}
+
+void run_generations(workers_t* workers, int n) {
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_gen);
+    /* An unlimited run-until-stable already asks for INT_MAX. */
+    data->required_gen += min(n, INT_MAX - data->required_gen);
+    pthread_cond_broadcast(&data->cv_req_gen);
+    pthread_mutex_unlock(&data->mtx_gen);
+}
+
+void finish_generations(workers_t* workers) {
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_gen);
+    while (data->current_gen < data->required_gen && !data->stop_requested) {
+        pthread_cond_wait(&data->cv_req_gen, &data->mtx_gen);
+    }
+    pthread_mutex_unlock(&data->mtx_gen);
 }
 
+/* A run-until-stable the controller has not picked up yet ends right away,
+ * one it is detecting with the pass in flight. */
 void stop(field_t* field, workers_t* workers) {
-    omp_set_lock(&workers->impl->cur_gen_lock);
-    #pragma omp critical
-    workers->impl->required_gen = min(workers->impl->current_gen + 1, workers->impl->required_gen);
-    omp_unset_lock(&workers->impl->cur_gen_lock);
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_gen);
+    data->required_gen = min(data->current_gen + 1, data->required_gen);
+    if (data->stable_state == kStableRequested) {
+        end_stable_run(data);
+    }
+    pthread_mutex_unlock(&data->mtx_gen);
+}
+
+/* Sleeps until generations are required and returns the depth of the next
+ * pass, marked as in flight, or 0 once the emulation stops. */
+static int start_pass(struct workers_internal* data) {
+    pthread_mutex_lock(&data->mtx_gen);
+    data->idle_since_ns = get_time_ns();
+    while (data->required_gen <= data->current_gen && data->stable_state != kStableRequested &&
+           !data->stop_requested) {
+        pthread_cond_wait(&data->cv_req_gen, &data->mtx_gen);
+    }
+    data->stats.idle_ns += (get_time_ns() - data->idle_since_ns) * data->threads;
+    data->idle_since_ns = 0;
+    if (data->stable_state == kStableRequested) {
+        start_hashing(&data->activity, &data->tiling, data->field);
+        detect_cycle(&data->detector, get_board_hash(&data->activity, &data->tiling));
+        data->required_gen = data->current_gen +
+                             min(data->stable_limit, INT_MAX - data->current_gen);
+        data->stable_state = kStableDetecting;
+    }
+    /* Generations are hashed one by one. */
+    const int max_depth = data->activity.hashing ? 1 : data->tiling.depth;
+    const int depth = data->stop_requested ? 0 : min(max_depth,
+                                                     data->required_gen - data->current_gen);
+    data->computing = depth > 0;
+    pthread_mutex_unlock(&data->mtx_gen);
+    return depth;
 }
 
 void run_controller_loop(field_t* field, workers_t* workers) {
-    const int width = field->width;
-    const int height = field->height;
-
-    int x, y;
-
-    while (!workers->impl->stop_requested) {
-        while (!workers->impl->stop_requested &&
-                workers->impl->required_gen > workers->impl->current_gen) {
-
-#pragma omp parallel default(shared) private(x, y)
-            for (x = 0; x < width; ++x) {
-                for (y = 0; y < height; ++y) {
-                    int alive_neighbors = 0;
-                    for (int dx = -1; dx <= 1; ++dx) {
-                        for (int dy = -1; dy <= 1; ++dy) {
-                            if (dx == 0 && dy == 0) {
-                                continue;
-                            }
-                            int nx = (x + dx + width) % width;
-                            int ny = (y + dy + height) % height;
-
-                            if (*get_cell(workers->impl->field, nx, ny)) {
-                                ++alive_neighbors;
-                            }
-                        }
-                    }
-
-                    *get_cell(workers->impl->next_field, x, y) = (alive_neighbors == 3) ||
-                        (alive_neighbors == 2 && *get_cell(workers->impl->field, x, y));
-                }
+    const tiling_t* tiling = &workers->impl->tiling;
+
+    int depth = 0;
+    while ((depth = start_pass(workers->impl)) > 0) {
+        const long long pass_start = get_time_ns();
+        activity_t* activity = get_pass_activity(&workers->impl->activity);
+        begin_activity_pass(&workers->impl->activity, depth);
+
+        #pragma omp parallel default(shared) num_threads(workers->impl->threads)
+        {
+            const long long start = get_time_ns();
+            #pragma omp for schedule(runtime) nowait
+            for (int column = 0; column < tiling->columns; ++column) {
+                step_tiles(workers->impl->field, workers->impl->next_field, tiling,
+                           column, column, depth,
+                           &workers->impl->scratch[omp_get_thread_num()], activity);
+                refresh_vertical_halo(workers->impl->next_field,
+                                      get_tile_from_x(tiling, column),
+                                      get_tile_to_x(tiling, column));
             }
+            atomic_fetch_add_explicit(&workers->impl->busy_ns[omp_get_thread_num()],
+                                      get_time_ns() - start, memory_order_relaxed);
+        }
+        refresh_horizontal_halo(workers->impl->next_field);
+        finish_activity_pass(&workers->impl->activity);
+        const long long pass_ns = get_time_ns() - pass_start;
+
+        stats_t stats;
+        pthread_mutex_lock(&workers->impl->mtx_gen);
+        workers->impl->current_gen += depth;
+        field_t* temp = workers->impl->field;
+        workers->impl->field = workers->impl->next_field;
+        workers->impl->next_field = temp;
+        atomic_fetch_add(&workers->impl->epoch, 1);
+        workers->impl->computing = false;
+        ++workers->impl->stats.passes;
+        workers->impl->stats.pass_ns += pass_ns;
+        workers->impl->stats.max_pass_ns = pass_ns > workers->impl->stats.max_pass_ns ?
+                                           pass_ns : workers->impl->stats.max_pass_ns;
+        const bool trace = is_trace_due();
+        if (trace) {
+            collect_stats(workers->impl, &stats);
+        }
+        if (workers->impl->stable_state == kStableDetecting) {
+            const uint64_t hash = get_board_hash(&workers->impl->activity, tiling);
+            const int period = detect_cycle(&workers->impl->detector, hash);
+            if (period > 0 || workers->impl->current_gen >= workers->impl->required_gen) {
+                stop_hashing(&workers->impl->activity);
+                destroy_cycle_detector(&workers->impl->detector);
+                workers->impl->required_gen = workers->impl->current_gen;
+                workers->impl->stable_state = kStableOff;
+                print_cycle(workers->impl->current_gen + workers->impl->gen_shift, period);
+            }
+        }
+        pthread_cond_broadcast(&workers->impl->cv_req_gen);
+        pthread_mutex_unlock(&workers->impl->mtx_gen);
 
-            omp_set_lock(&workers->impl->cur_gen_lock);
-            ++workers->impl->current_gen;
-            field_t* temp = workers->impl->field;
-            workers->impl->field = workers->impl->next_field;
-            workers->impl->next_field = temp;
-            omp_unset_lock(&workers->impl->cur_gen_lock);
+        if (trace) {
+            write_trace(&stats);
         }
-        usleep(10000);
     }
 }
 
 void stop_emulation(workers_t* workers) {
-    #pragma omp critical
+    pthread_mutex_lock(&workers->impl->mtx_gen);
     workers->impl->stop_requested = true;
+    pthread_cond_broadcast(&workers->impl->cv_req_gen);
+    pthread_mutex_unlock(&workers->impl->mtx_gen);
 }
@@ -1,127 +1,509 @@
 #include <interface.h>
+#include <kernel.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdatomic.h>
 #include <pthread.h>
+#include <unistd.h>
 #include <stdio.h>
+#include <limits.h>
 
-#define kSlaveThreadsCount 4
+#define kCacheLineSize 64
+#define kBarrierSpins  (1 << 10)
 
+/* Sense-reversing barrier. Waiters spin for a while, which is all it takes
+ * between two passes, and then fall asleep, so that an idle pool does not
+ * burn CPUs while nothing is requested. */
 typedef struct {
+    _Alignas(kCacheLineSize) atomic_int waiting;
+    _Alignas(kCacheLineSize) atomic_bool sense;
+    int count;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+} barrier_t;
+
+/* --schedule=steal: tiles are numbered column by column, tile column c and
+ * tile row r being tile c * rows + r. Each worker's deque is a range
+ * [head, tail) of those numbers packed in one word: the owner pops from the
+ * head and thieves cut off the tail half, both with a CAS. At the start of a
+ * pass every deque is refilled with the worker's home stripe, so tiles stay
+ * on the same core as long as the load is even.
+ *
+ * --schedule=wavefront: every worker owns a stripe of tile columns and
+ * advances it on its own, publishing `gen` after each generation. */
+typedef struct {
+    _Alignas(kCacheLineSize) atomic_uint_fast64_t tiles;
+    atomic_int gen;
+    /* Only written by the worker itself; wait and idle in wavefront mode.
+     * idle_since_ns is when the idle wait in progress began, or 0. */
+    atomic_llong busy_ns, wait_ns, idle_ns;
+    atomic_llong idle_since_ns;
     pthread_t thread_descr;
-    int min_x, max_x;
-    int local_gen;
+    int from_tile, to_tile;
+    int from_column, to_column;
     struct workers_internal* shared;
-    pthread_mutex_t mtx_local_gen;
-    pthread_cond_t cv_local_gen;
-} slave_thread_t;
+    tile_scratch_t scratch;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+} worker_t;
 
 struct workers_internal {
-    pthread_t master_thread;
-    slave_thread_t slave_threads[kSlaveThreadsCount];
+    worker_t* workers;
+    int workers_count;
+    barrier_t barrier;
+
     atomic_int required_gen;
-    atomic_int current_gen;
+    int current_gen;
+    /* Set while the last worker at the barrier waits for more generations,
+     * so nothing reads or writes the fields. */
+    bool idle;
+    /* Added to generation numbers shown to the user; `load` sets it to the
+     * snapshot's generation less the one the workers are at. */
+    int gen_shift;
+    /* Bumped under mtx_gen whenever `field` changes. The published field is
+     * not written before the next swap, so a copy of it taken without the
+     * lock is consistent if the epoch stayed the same meanwhile. */
+    atomic_int epoch;
+    /* What dump_field and save_field print and write, see take_snapshot. */
+    field_t snapshot;
     field_t* field;
     field_t* next_field;
     atomic_bool stop_required;
 
-    pthread_cond_t  cv_req_gen,  cv_cur_gen;
-    pthread_mutex_t mtx_req_gen, mtx_cur_gen;
+    /* Wavefront mode keeps generation g in buffers[g % 2]. Workers do not
+     * go past hold_gen, which dump_field lowers to get a consistent board. */
+    field_t* buffers[2];
+    atomic_int hold_gen;
+
+    tiling_t tiling;
+    activity_t activity;
+    /* Generations the workers advance in the current pass, 0 to quit. Only
+     * written by the last thread at the barrier. */
+    int pass_depth;
+    long long pass_start_ns;
+    /* Pass, idle and snapshot counters, under mtx_gen; idle time is added
+     * once the wait that began at idle_since_ns is over. */
+    stats_t stats;
+    long long idle_since_ns;
+
+    /* run-until-stable, under mtx_gen. The last worker at the barrier picks
+     * up the request and then checks every generation published for a
+     * repeat until a period turns up or the run ends. */
+    stable_state_t stable_state;
+    int stable_limit;
+    cycle_detector_t detector;
+
+    pthread_cond_t  cv_req_gen;
+    pthread_mutex_t mtx_gen;
 };
 
-const int DX[] = {-1, -1, -1,  0, 0,  1, 1, 1};
-const int DY[] = {-1,  0,  1, -1, 1, -1, 0, 1};
-const int kNeighborsCount = 8;
-
 static inline int min(int x, int y) {
     return x < y ? x : y;
 }
 
-void* slave_thread(void* arg) {
-    slave_thread_t* data = arg;
+static inline uint64_t make_range(int head, int tail) {
+    return (uint64_t)head << 32 | (uint32_t)tail;
+}
+
+static inline int get_head(uint64_t range) {
+    return (int)(range >> 32);
+}
 
-    bool stop_required = false;
+static inline int get_tail(uint64_t range) {
+    return (int)(uint32_t)range;
+}
 
-    while (true) {
-        pthread_mutex_lock(&data->shared->mtx_cur_gen);
-        while (data->local_gen > data->shared->current_gen &&
-               !data->shared->stop_required) {
-            pthread_cond_wait(&data->shared->cv_cur_gen, &data->shared->mtx_cur_gen);
-        }
-        stop_required = data->shared->stop_required;
-        pthread_mutex_unlock(&data->shared->mtx_cur_gen);
-        if (stop_required) {
-            break;
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void init_barrier(barrier_t* barrier, int count) {
+    atomic_init(&barrier->waiting, count);
+    atomic_init(&barrier->sense, false);
+    barrier->count = count;
+    pthread_mutex_init(&barrier->mtx, NULL);
+    pthread_cond_init(&barrier->cv, NULL);
+}
+
+static void destroy_barrier(barrier_t* barrier) {
+    pthread_mutex_destroy(&barrier->mtx);
+    pthread_cond_destroy(&barrier->cv);
+}
+
+/* Returns true in the thread that arrives last. That thread does the serial
+ * part of the step and then lets the others go with release_barrier. */
+static bool arrive_at_barrier(barrier_t* barrier, bool sense) {
+    if (atomic_fetch_sub_explicit(&barrier->waiting, 1, memory_order_acq_rel) == 1) {
+        return true;
+    }
+    for (int i = 0; i < kBarrierSpins; ++i) {
+        if (atomic_load_explicit(&barrier->sense, memory_order_acquire) == sense) {
+            return false;
         }
+        cpu_relax();
+    }
+    pthread_mutex_lock(&barrier->mtx);
+    while (atomic_load_explicit(&barrier->sense, memory_order_acquire) != sense) {
+        pthread_cond_wait(&barrier->cv, &barrier->mtx);
+    }
+    pthread_mutex_unlock(&barrier->mtx);
+    return false;
+}
 
+static void release_barrier(barrier_t* barrier, bool sense) {
+    atomic_store_explicit(&barrier->waiting, barrier->count, memory_order_relaxed);
+    pthread_mutex_lock(&barrier->mtx);
+    atomic_store_explicit(&barrier->sense, sense, memory_order_release);
+    pthread_cond_broadcast(&barrier->cv);
+    pthread_mutex_unlock(&barrier->mtx);
+}
 
-        pthread_mutex_lock(&data->mtx_local_gen);
-        for (int x = data->min_x; x <= data->max_x; ++x) {
-            for (int y = 0; y < data->shared->field->height; ++y) {
-                int alive_neigbors = 0;
-                for (int i = 0; i < kNeighborsCount; ++i) {
-                    int nx = (x + DX[i] + data->shared->field->width) %
-                            data->shared->field->width;
-                    int ny = (y + DY[i] + data->shared->field->height) %
-                            data->shared->field->height;
-                    if (*get_cell(data->shared->field, nx, ny)) {
-                        ++alive_neigbors;
-                    }
-                }
-                *get_cell(data->shared->next_field, x, y) = (alive_neigbors == 3) ||
-                    (alive_neigbors == 2 && *get_cell(data->shared->field, x, y));
+static bool pop_tile(worker_t* worker, int* tile) {
+    uint64_t range = atomic_load_explicit(&worker->tiles, memory_order_relaxed);
+    do {
+        if (get_head(range) >= get_tail(range)) {
+            return false;
+        }
+        *tile = get_head(range);
+    } while (!atomic_compare_exchange_weak(&worker->tiles, &range,
+                                           make_range(get_head(range) + 1, get_tail(range))));
+    return true;
+}
+
+/* Moves the tail half of some other deque into the thief's, which is empty.
+ * No tiles are added during a pass, so once every deque is seen empty the
+ * pass is over for this worker. */
+static bool steal_tiles(worker_t* thief) {
+    struct workers_internal* data = thief->shared;
+    const int self = thief - data->workers;
+
+    for (int i = 1; i < data->workers_count; ++i) {
+        worker_t* victim = &data->workers[(self + i) % data->workers_count];
+        uint64_t range = atomic_load_explicit(&victim->tiles, memory_order_relaxed);
+        while (get_head(range) < get_tail(range)) {
+            int half = (get_tail(range) - get_head(range) + 1) / 2;
+            if (atomic_compare_exchange_weak(&victim->tiles, &range,
+                                             make_range(get_head(range), get_tail(range) - half))) {
+                atomic_store(&thief->tiles, make_range(get_tail(range) - half, get_tail(range)));
+                return true;
             }
         }
-        ++data->local_gen;
-        pthread_cond_signal(&data->cv_local_gen);
-        pthread_mutex_unlock(&data->mtx_local_gen);
     }
-
-    pthread_exit(NULL);
+    return false;
 }
 
-void* master_thread(void* arg) {
-    struct workers_internal* data = arg;
+static int get_latest_gen(struct workers_internal* data);
+
+/* Called with mtx_gen held. In steal mode whatever a worker is not busy
+ * with during a pass it spends at the barrier. */
+static void collect_stats(struct workers_internal* data, stats_t* stats) {
+    const long long now = get_time_ns();
+    *stats = data->stats;
+    stats->generation = get_latest_gen(data) + data->gen_shift;
+    stats->workers = data->workers_count;
+    if (data->idle_since_ns > 0) {
+        stats->idle_ns += (now - data->idle_since_ns) * data->workers_count;
+    }
+    for (int i = 0; i < data->workers_count; ++i) {
+        worker_t* worker = &data->workers[i];
+        const long long idle_since = atomic_load_explicit(&worker->idle_since_ns,
+                                                          memory_order_relaxed);
+        stats->busy_ns += atomic_load_explicit(&worker->busy_ns, memory_order_relaxed);
+        stats->wait_ns += atomic_load_explicit(&worker->wait_ns, memory_order_relaxed);
+        stats->idle_ns += atomic_load_explicit(&worker->idle_ns, memory_order_relaxed) +
+                          (idle_since > 0 ? now - idle_since : 0);
+    }
+    if (options.schedule != kScheduleWavefront) {
+        stats->wait_ns = data->workers_count * stats->pass_ns - stats->busy_ns;
+        stats->wait_ns = stats->wait_ns < 0 ? 0 : stats->wait_ns;
+    }
+}
 
-    bool stop_required = false;
+/* Serial part between two passes: publish the pass just computed, then
+ * wait until more generations are required and pick the next depth. Tiles
+ * of one column may be computed by different workers, so the whole halo is
+ * refreshed here. */
+static void advance_generation(struct workers_internal* data) {
+    const long long pass_ns = get_time_ns() - data->pass_start_ns;
+    if (data->pass_depth > 0) {
+        refresh_halo(data->next_field);
+        finish_activity_pass(&data->activity);
+    }
 
-    while (true) {
-        pthread_mutex_lock(&data->mtx_req_gen);
-        while (data->required_gen <= data->current_gen &&
+    stats_t stats;
+    bool trace = false;
+    pthread_mutex_lock(&data->mtx_gen);
+    if (data->pass_depth > 0) {
+        data->current_gen += data->pass_depth;
+        field_t* temp = data->field;
+        data->field = data->next_field;
+        data->next_field = temp;
+        atomic_fetch_add(&data->epoch, 1);
+
+        ++data->stats.passes;
+        data->stats.pass_ns += pass_ns;
+        data->stats.max_pass_ns = pass_ns > data->stats.max_pass_ns ? pass_ns
+                                                                    : data->stats.max_pass_ns;
+        trace = is_trace_due();
+        if (trace) {
+            collect_stats(data, &stats);
+        }
+        if (data->stable_state == kStableDetecting) {
+            const int period = detect_cycle(&data->detector,
+                                            get_board_hash(&data->activity, &data->tiling));
+            if (period > 0 || data->current_gen >= data->required_gen) {
+                stop_hashing(&data->activity);
+                destroy_cycle_detector(&data->detector);
+                data->required_gen = data->current_gen;
+                data->stable_state = kStableOff;
+                print_cycle(data->current_gen + data->gen_shift, period);
+            }
+        }
+    }
+    data->idle = data->required_gen <= data->current_gen && data->stable_state != kStableRequested;
+    if (data->idle) {
+        pthread_cond_broadcast(&data->cv_req_gen);
+        data->idle_since_ns = get_time_ns();
+        while (data->required_gen <= data->current_gen && data->stable_state != kStableRequested &&
                !data->stop_required) {
-            pthread_cond_wait(&data->cv_req_gen, &data->mtx_req_gen);
+            pthread_cond_wait(&data->cv_req_gen, &data->mtx_gen);
         }
-        stop_required = data->stop_required;
-        pthread_mutex_unlock(&data->mtx_req_gen);
+        data->stats.idle_ns += (get_time_ns() - data->idle_since_ns) * data->workers_count;
+        data->idle_since_ns = 0;
+    }
+    data->idle = false;
+    if (data->stable_state == kStableRequested) {
+        start_hashing(&data->activity, &data->tiling, data->field);
+        detect_cycle(&data->detector, get_board_hash(&data->activity, &data->tiling));
+        data->required_gen = data->current_gen +
+                             min(data->stable_limit, INT_MAX - data->current_gen);
+        data->stable_state = kStableDetecting;
+    }
+    /* Generations are hashed one by one. */
+    const int depth = data->activity.hashing ? 1 : data->tiling.depth;
+    data->pass_depth = data->stop_required ? 0 :
+                       min(depth, data->required_gen - data->current_gen);
+    pthread_mutex_unlock(&data->mtx_gen);
+
+    if (trace) {
+        write_trace(&stats);
+    }
+
+    if (data->pass_depth > 0) {
+        begin_activity_pass(&data->activity, data->pass_depth);
+        for (int i = 0; i < data->workers_count; ++i) {
+            atomic_store_explicit(&data->workers[i].tiles,
+                                  make_range(data->workers[i].from_tile, data->workers[i].to_tile),
+                                  memory_order_relaxed);
+        }
+    }
+    data->pass_start_ns = get_time_ns();
+}
+
+void* worker_thread(void* arg) {
+    worker_t* worker = arg;
+    struct workers_internal* data = worker->shared;
 
-        if (stop_required) {
+    bool sense = false;
+    while (true) {
+        sense = !sense;
+        if (arrive_at_barrier(&data->barrier, sense)) {
+            advance_generation(data);
+            release_barrier(&data->barrier, sense);
+        }
+        if (data->pass_depth == 0) {
             break;
         }
 
-        for (int i = 0; i < kSlaveThreadsCount; ++i) {
-            pthread_mutex_lock(&data->slave_threads[i].mtx_local_gen);
-            while (data->slave_threads[i].local_gen <= data->current_gen &&
-                   !data->stop_required) {
-                pthread_cond_wait(&data->slave_threads[i].cv_local_gen,
-                                  &data->slave_threads[i].mtx_local_gen);
-            }
-            stop_required = data->stop_required;
-            pthread_mutex_unlock(&data->slave_threads[i].mtx_local_gen);
-            if (stop_required) {
-                pthread_exit(NULL);
+        const long long start = get_time_ns();
+        int tile = 0;
+        while (pop_tile(worker, &tile) || (steal_tiles(worker) && pop_tile(worker, &tile))) {
+            step_tile(data->field, data->next_field, &data->tiling,
+                      tile / data->tiling.rows, tile % data->tiling.rows, data->pass_depth,
+                      &worker->scratch, get_pass_activity(&data->activity));
+        }
+        atomic_fetch_add_explicit(&worker->busy_ns, get_time_ns() - start, memory_order_relaxed);
+    }
+
+    pthread_exit(NULL);
+}
+
+static void wake_worker(worker_t* worker) {
+    pthread_mutex_lock(&worker->mtx);
+    pthread_cond_broadcast(&worker->cv);
+    pthread_mutex_unlock(&worker->mtx);
+}
+
+/* A stripe may compute generation gen + 1 once both neighbors have
+ * published gen. Then no stripe gets two generations ahead of a neighbor,
+ * so buffers[gen % 2] still holds the neighbors' columns it reads and
+ * nobody reads the columns it overwrites. The same goes for the activity
+ * flags of the pass, which are kept per parity as well. */
+static bool can_advance(const worker_t* worker, const worker_t* left, const worker_t* right,
+                        int gen) {
+    const struct workers_internal* data = worker->shared;
+    return atomic_load(&data->stop_required) ||
+           (gen < min(atomic_load(&data->required_gen), atomic_load(&data->hold_gen)) &&
+            atomic_load(&left->gen) >= gen && atomic_load(&right->gen) >= gen);
+}
+
+/* Ghost cells the stripe is responsible for: its rows -1 and `height`, and
+ * the ghost column that copies its edge column of the board, if it has one. */
+static void refresh_stripe_halo(field_t* field, int min_x, int max_x) {
+    refresh_vertical_halo(field, min_x, max_x);
+    if (min_x == 0) {
+        memcpy(get_column(field, field->width) - 1, get_column(field, 0) - 1,
+               field->stride * sizeof(uint64_t));
+    }
+    if (max_x == field->width - 1) {
+        memcpy(get_column(field, -1) - 1, get_column(field, field->width - 1) - 1,
+               field->stride * sizeof(uint64_t));
+    }
+}
+
+void* wavefront_thread(void* arg) {
+    worker_t* worker = arg;
+    struct workers_internal* data = worker->shared;
+    const int self = worker - data->workers;
+    worker_t* left = &data->workers[(self + data->workers_count - 1) % data->workers_count];
+    worker_t* right = &data->workers[(self + 1) % data->workers_count];
+    const int min_x = get_tile_from_x(&data->tiling, worker->from_column);
+    const int max_x = get_tile_to_x(&data->tiling, worker->to_column);
+
+    int gen = 0;
+    while (true) {
+        /* Waiting counts as idle if the stripe is done with what is required. */
+        const long long wait_start = get_time_ns();
+        const bool idle = gen >= atomic_load(&data->required_gen);
+        if (idle) {
+            atomic_store_explicit(&worker->idle_since_ns, wait_start, memory_order_relaxed);
+        }
+        bool ready = false;
+        for (int i = 0; i < kBarrierSpins && !ready; ++i) {
+            ready = can_advance(worker, left, right, gen);
+            cpu_relax();
+        }
+        if (!ready) {
+            pthread_mutex_lock(&worker->mtx);
+            while (!can_advance(worker, left, right, gen)) {
+                pthread_cond_wait(&worker->cv, &worker->mtx);
             }
+            pthread_mutex_unlock(&worker->mtx);
+        }
+        const long long step_start = get_time_ns();
+        atomic_fetch_add_explicit(idle ? &worker->idle_ns : &worker->wait_ns,
+                                  step_start - wait_start, memory_order_relaxed);
+        atomic_store_explicit(&worker->idle_since_ns, 0, memory_order_relaxed);
+        if (atomic_load(&data->stop_required)) {
+            break;
         }
 
-        pthread_mutex_lock(&data->mtx_cur_gen);
-        ++data->current_gen;
-        field_t* temp = data->field;
-        data->field = data->next_field;
-        data->next_field = temp;
-        pthread_cond_broadcast(&data->cv_cur_gen);
-        pthread_mutex_unlock(&data->mtx_cur_gen);
+        activity_t activity = {
+            .changed = gen % 2 == 0 ? data->activity.changed : data->activity.next_changed,
+            .next_changed = gen % 2 == 0 ? data->activity.next_changed : data->activity.changed,
+            .flags_depth = 1,
+            .pass_depth = 1,
+            .all_active = false,
+        };
+        field_t* next_field = data->buffers[(gen + 1) % 2];
+        step_tiles(data->buffers[gen % 2], next_field, &data->tiling,
+                   worker->from_column, worker->to_column, 1, &worker->scratch,
+                   options.track_activity ? &activity : NULL);
+        refresh_stripe_halo(next_field, min_x, max_x);
+        atomic_fetch_add_explicit(&worker->busy_ns, get_time_ns() - step_start,
+                                  memory_order_relaxed);
+
+        atomic_store(&worker->gen, ++gen);
+        wake_worker(left);
+        wake_worker(right);
+        /* Either this sees a lowered hold_gen or drain_wavefront sees gen. */
+        if (gen >= min(atomic_load(&data->required_gen), atomic_load(&data->hold_gen))) {
+            pthread_mutex_lock(&data->mtx_gen);
+            pthread_cond_broadcast(&data->cv_req_gen);
+            pthread_mutex_unlock(&data->mtx_gen);
+        }
+        if (self == 0 && is_trace_due()) {
+            stats_t stats;
+            pthread_mutex_lock(&data->mtx_gen);
+            collect_stats(data, &stats);
+            pthread_mutex_unlock(&data->mtx_gen);
+            write_trace(&stats);
+        }
     }
+
     pthread_exit(NULL);
 }
 
+static void wake_workers(struct workers_internal* data) {
+    pthread_cond_broadcast(&data->cv_req_gen);
+    if (options.schedule == kScheduleWavefront) {
+        for (int i = 0; i < data->workers_count; ++i) {
+            wake_worker(&data->workers[i]);
+        }
+    }
+}
+
+static int get_latest_gen(struct workers_internal* data) {
+    if (options.schedule != kScheduleWavefront) {
+        return data->current_gen;
+    }
+    int gen = 0;
+    for (int i = 0; i < data->workers_count; ++i) {
+        int worker_gen = atomic_load(&data->workers[i].gen);
+        gen = worker_gen > gen ? worker_gen : gen;
+    }
+    return gen;
+}
+
+static int get_earliest_gen(struct workers_internal* data) {
+    if (options.schedule != kScheduleWavefront) {
+        return data->current_gen;
+    }
+    int gen = INT_MAX;
+    for (int i = 0; i < data->workers_count; ++i) {
+        gen = min(gen, atomic_load(&data->workers[i].gen));
+    }
+    return gen;
+}
+
+/* Lowers `limit` to one past the latest generation, but not above `cap`,
+ * and returns it. A stripe that began a generation before the store may
+ * still finish it; it had published the one it began from by then, so the
+ * latest generation read after the store bounds it. Every stripe ends up at
+ * the returned generation or below. */
+static int lower_gen_limit(struct workers_internal* data, atomic_int* limit, int cap) {
+    atomic_store(limit, min(cap, get_latest_gen(data) + 1));
+    const int gen = min(cap, get_latest_gen(data) + 1);
+    atomic_store(limit, gen);
+    return gen;
+}
+
+/* Lets every stripe catch up with the most advanced one and keeps them
+ * there until resume_wavefront. Called with mtx_gen held. */
+static int drain_wavefront(struct workers_internal* data) {
+    const int gen = lower_gen_limit(data, &data->hold_gen, atomic_load(&data->required_gen));
+    wake_workers(data);
+
+    bool drained = false;
+    while (!drained) {
+        drained = true;
+        for (int i = 0; i < data->workers_count && drained; ++i) {
+            drained = atomic_load(&data->workers[i].gen) == gen;
+        }
+        if (!drained) {
+            pthread_cond_wait(&data->cv_req_gen, &data->mtx_gen);
+        }
+    }
+    return gen;
+}
+
+static void resume_wavefront(struct workers_internal* data) {
+    atomic_store(&data->hold_gen, INT_MAX);
+    wake_workers(data);
+}
+
 const char* get_version() {
     return "0.1_pthread";
 }
@@ -130,108 +512,272 @@ static field_t second_field;
 
 const char* setup_workers(field_t* field, workers_t* workers) {
     workers->impl = calloc(1, sizeof(struct workers_internal));
-
-    workers->impl->required_gen = 0;
-    workers->impl->current_gen = 0;
-    workers->impl->field = field;
+    struct workers_internal* data = workers->impl;
+
+    data->required_gen = 0;
+    data->current_gen = 0;
+    data->idle = false;
+    data->gen_shift = 0;
+    atomic_init(&data->epoch, 0);
+    init_field(&data->snapshot, field->width, field->height);
+    data->field = field;
     init_field(&second_field, field->width, field->height);
-    workers->impl->next_field = &second_field;
-    workers->impl->stop_required = false;
-
-    pthread_cond_init(&workers->impl->cv_req_gen, NULL);
-    pthread_cond_init(&workers->impl->cv_cur_gen, NULL);
-    pthread_mutex_init(&workers->impl->mtx_cur_gen, NULL);
-    pthread_mutex_init(&workers->impl->mtx_req_gen, NULL);
-
-    int last_max_x = -1;
-    int stripe_width = (field->width - 1) / kSlaveThreadsCount + 1;
-    for (int i = 0; i < kSlaveThreadsCount; ++i) {
-        workers->impl->slave_threads[i].min_x = last_max_x + 1;
-        last_max_x = workers->impl->slave_threads[i].max_x = min(field->width - 1,
-                                            last_max_x + stripe_width);
-
-        workers->impl->slave_threads[i].local_gen = 0;
-        workers->impl->slave_threads[i].shared = workers->impl;
-
-        pthread_cond_init(&workers->impl->slave_threads[i].cv_local_gen, NULL);
-        pthread_mutex_init(&workers->impl->slave_threads[i].mtx_local_gen, NULL);
+    data->next_field = &second_field;
+    data->stop_required = false;
+    data->buffers[0] = field;
+    data->buffers[1] = &second_field;
+    data->hold_gen = INT_MAX;
+    data->tiling = make_tiling(field);
+    if (options.schedule == kScheduleWavefront) {
+        /* Stripes move one generation at a time. */
+        data->tiling.depth = 1;
+    }
+    init_activity(&data->activity, &data->tiling);
+    data->pass_depth = 0;
+    data->pass_start_ns = get_time_ns();
+    memset(&data->stats, 0, sizeof(data->stats));
+    data->idle_since_ns = 0;
+    data->stable_state = kStableOff;
+
+    pthread_cond_init(&data->cv_req_gen, NULL);
+    pthread_mutex_init(&data->mtx_gen, NULL);
+
+    const tiling_t* tiling = &data->tiling;
+    const int tiles = tiling->columns * tiling->rows;
+    int threads = options.threads > 0 ? options.threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    data->workers_count = min(threads < 1 ? 1 : threads,
+                              options.schedule == kScheduleWavefront ? tiling->columns : tiles);
+    data->workers = aligned_alloc(kCacheLineSize, data->workers_count * sizeof(worker_t));
+    memset(data->workers, 0, data->workers_count * sizeof(worker_t));
+    init_barrier(&data->barrier, data->workers_count);
+
+    for (int i = 0; i < data->workers_count; ++i) {
+        worker_t* worker = &data->workers[i];
+        worker->from_tile = (int)((long)tiles * i / data->workers_count);
+        worker->to_tile = (int)((long)tiles * (i + 1) / data->workers_count);
+        worker->from_column = (int)((long)tiling->columns * i / data->workers_count);
+        worker->to_column = (int)((long)tiling->columns * (i + 1) / data->workers_count) - 1;
+        atomic_init(&worker->tiles, make_range(0, 0));
+        atomic_init(&worker->gen, 0);
+        atomic_init(&worker->busy_ns, 0);
+        atomic_init(&worker->wait_ns, 0);
+        atomic_init(&worker->idle_ns, 0);
+        atomic_init(&worker->idle_since_ns, 0);
+        worker->shared = data;
+        init_tile_scratch(&worker->scratch, tiling);
+        pthread_mutex_init(&worker->mtx, NULL);
+        pthread_cond_init(&worker->cv, NULL);
     }
 
-    pthread_create(&workers->impl->master_thread, NULL, master_thread, workers->impl);
-    for (int i = 0; i < kSlaveThreadsCount; ++i) {
-        pthread_create(&workers->impl->slave_threads[i].thread_descr, NULL, slave_thread,
-                       workers->impl->slave_threads + i);
+    for (int i = 0; i < data->workers_count; ++i) {
+        pthread_create(&data->workers[i].thread_descr, NULL,
+                       options.schedule == kScheduleWavefront ? wavefront_thread : worker_thread,
+                       data->workers + i);
     }
 
     return NULL;
 }
 
 void destroy_workers(workers_t* workers) {
-    workers->impl->stop_required = true;
+    struct workers_internal* data = workers->impl;
 
-    pthread_cond_broadcast(&workers->impl->cv_cur_gen);
-    pthread_cond_broadcast(&workers->impl->cv_req_gen);
-    for (int i = 0; i < kSlaveThreadsCount; ++i) {
-        pthread_cond_broadcast(&workers->impl->slave_threads[i].cv_local_gen);
-    }
+    pthread_mutex_lock(&data->mtx_gen);
+    data->stop_required = true;
+    wake_workers(data);
+    pthread_mutex_unlock(&data->mtx_gen);
 
     void* ret_val = NULL;
-    pthread_join(workers->impl->master_thread, &ret_val);
-    for (int i = 0; i < kSlaveThreadsCount; ++i) {
-        pthread_join(workers->impl->slave_threads[i].thread_descr, &ret_val);
+    for (int i = 0; i < data->workers_count; ++i) {
+        pthread_join(data->workers[i].thread_descr, &ret_val);
+        destroy_tile_scratch(&data->workers[i].scratch);
+        pthread_mutex_destroy(&data->workers[i].mtx);
+        pthread_cond_destroy(&data->workers[i].cv);
     }
 
-    pthread_mutex_destroy(&workers->impl->mtx_cur_gen);
-    pthread_mutex_destroy(&workers->impl->mtx_req_gen);
-    pthread_cond_destroy(&workers->impl->cv_cur_gen);
-    pthread_cond_destroy(&workers->impl->cv_req_gen);
+    destroy_barrier(&data->barrier);
+    pthread_mutex_destroy(&data->mtx_gen);
+    pthread_cond_destroy(&data->cv_req_gen);
 
-    for (int i = 0; i < kSlaveThreadsCount; ++i) {
-        pthread_mutex_destroy(&workers->impl->slave_threads[i].mtx_local_gen);
-        pthread_cond_destroy(&workers->impl->slave_threads[i].cv_local_gen);
+    if (data->stable_state != kStableOff) {
+        destroy_cycle_detector(&data->detector);
     }
-
+    destroy_activity(&data->activity);
     destroy_field(&second_field);
-    free(workers->impl);
+    destroy_field(&data->snapshot);
+    free(data->workers);
+    free(data);
+}
+
+/* Copies the latest generation to data->snapshot and returns its number.
+ * The workers go on meanwhile: in steal mode the copy is retried if a swap
+ * got in the way and only the last try holds mtx_gen; wavefront stripes are
+ * held back for the time of the copy. */
+static int take_snapshot(struct workers_internal* data) {
+    const long long start = get_time_ns();
+    int gen = 0;
+    const bool copied = options.schedule != kScheduleWavefront &&
+                        copy_published_field(&data->snapshot, &data->field, &data->current_gen,
+                                             &data->gen_shift, &data->epoch, &data->mtx_gen,
+                                             &gen);
+    pthread_mutex_lock(&data->mtx_gen);
+    if (!copied) {
+        gen = data->current_gen;
+        const field_t* current_field = data->field;
+        if (options.schedule == kScheduleWavefront) {
+            gen = drain_wavefront(data);
+            current_field = data->buffers[gen % 2];
+        }
+        copy_field(&data->snapshot, current_field);
+        if (options.schedule == kScheduleWavefront) {
+            resume_wavefront(data);
+        }
+        gen += data->gen_shift;
+    }
+    ++data->stats.snapshots;
+    data->stats.snapshot_ns += get_time_ns() - start;
+    pthread_mutex_unlock(&data->mtx_gen);
+    return gen;
 }
 
 void dump_field(field_t* field, workers_t* workers) {
-    pthread_mutex_lock(&workers->impl->mtx_cur_gen);
-    printf("# Current iteration: %d\n", workers->impl->current_gen);
-    for (int y = 0; y < workers->impl->field->height; ++y) {
-        printf("# ");
-        for (int x = 0; x < workers->impl->field->width; ++x) {
-            char ch = '_';
-            if (*get_cell(workers->impl->field, x, y)) {
-                ch = 'O';
-            }
-            printf("%c", ch);
+    struct workers_internal* data = workers->impl;
+    int gen = take_snapshot(data);
+    print_field(&data->snapshot, gen);
+}
+
+void dump_stats(field_t* field, workers_t* workers) {
+    stats_t stats;
+    pthread_mutex_lock(&workers->impl->mtx_gen);
+    collect_stats(workers->impl, &stats);
+    pthread_mutex_unlock(&workers->impl->mtx_gen);
+    print_stats(&stats);
+}
+
+void save_field(field_t* field, workers_t* workers) {
+    char path[kMaxPathLength];
+    if (!scan_path(path)) {
+        return;
+    }
+
+    struct workers_internal* data = workers->impl;
+    int gen = take_snapshot(data);
+    const char* err_msg = save_snapshot(path, &data->snapshot, gen);
+    if (err_msg != NULL) {
+        printf("# %s\n", err_msg);
+    }
+}
+
+/* Ends a run-until-stable the workers have not picked up yet, which would
+ * otherwise start once they are idle. One they are detecting ends with the
+ * pass in flight, as the run is cut short. Called with mtx_gen held. */
+static void cancel_stable_request(struct workers_internal* data) {
+    if (data->stable_state == kStableRequested) {
+        destroy_cycle_detector(&data->detector);
+        data->stable_state = kStableOff;
+        print_cycle(data->current_gen + data->gen_shift, 0);
+    }
+}
+
+/* Stops the run where it is and overwrites the board in place, once no
+ * worker touches it. */
+void load_field(field_t* field, workers_t* workers) {
+    char path[kMaxPathLength];
+    if (!scan_path(path)) {
+        return;
+    }
+
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_gen);
+    cancel_stable_request(data);
+    int gen = data->current_gen;
+    field_t* current_field = data->field;
+    if (options.schedule == kScheduleWavefront) {
+        gen = drain_wavefront(data);
+        current_field = data->buffers[gen % 2];
+        data->required_gen = gen;
+    } else {
+        data->required_gen = data->current_gen;
+        while (!data->idle) {
+            pthread_cond_wait(&data->cv_req_gen, &data->mtx_gen);
         }
-        printf("\n");
+        gen = data->current_gen;
+        current_field = data->field;
+    }
+
+    long long snapshot_gen = 0;
+    const char* err_msg = load_snapshot(path, current_field, &snapshot_gen);
+    if (err_msg == NULL) {
+        atomic_fetch_add(&data->epoch, 1);
+        reset_activity(&data->activity, &data->tiling);
+        data->gen_shift = (int)snapshot_gen - gen;
+    }
+    if (options.schedule == kScheduleWavefront) {
+        resume_wavefront(data);
+    }
+    pthread_mutex_unlock(&data->mtx_gen);
+
+    if (err_msg != NULL) {
+        printf("# %s\n", err_msg);
     }
-    pthread_mutex_unlock(&workers->impl->mtx_cur_gen);
 }
 
 void run(field_t* field, workers_t* workers) {
     int n = 0;
-    if (scanf("%d", &n) != 1 || n <= 0) {
-        printf("# Positive integer expected\n");
+    if (!scan_count(&n)) {
         return;
     }
 
-    pthread_mutex_lock(&workers->impl->mtx_req_gen);
-    workers->impl->required_gen += n;
-    pthread_cond_signal(&workers->impl->cv_req_gen);
-    pthread_mutex_unlock(&workers->impl->mtx_req_gen);
+    run_generations(workers, n);
 }
 
-void stop(field_t* field, workers_t* workers) {
-    pthread_mutex_lock(&workers->impl->mtx_cur_gen);
-    pthread_mutex_lock(&workers->impl->mtx_req_gen);
-    //workers->impl->required_gen = workers->impl->current_gen + 1;
-    workers->impl->required_gen = min(workers->impl->current_gen + 1, workers->impl->required_gen);
-    pthread_cond_signal(&workers->impl->cv_req_gen);
-    pthread_mutex_unlock(&workers->impl->mtx_req_gen);
-    pthread_mutex_unlock(&workers->impl->mtx_cur_gen);
+/* Replaces whatever run is in progress, be it a run-until-stable too. The
+ * outcome is printed once the run ends. */
+void run_until_stable(field_t* field, workers_t* workers) {
+    int limit = 0;
+    if (!scan_limit(&limit)) {
+        return;
+    }
+    if (options.schedule == kScheduleWavefront) {
+        printf("# run-until-stable needs --schedule=steal\n");
+        return;
+    }
+
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_gen);
+    if (data->stable_state != kStableOff) {
+        destroy_cycle_detector(&data->detector);
+    }
+    init_cycle_detector(&data->detector);
+    data->stable_limit = limit > 0 ? limit : INT_MAX;
+    data->stable_state = kStableRequested;
+    wake_workers(data);
+    pthread_mutex_unlock(&data->mtx_gen);
 }
 
+void run_generations(workers_t* workers, int n) {
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_gen);
+    /* An unlimited run-until-stable already asks for INT_MAX. */
+    atomic_fetch_add(&data->required_gen, min(n, INT_MAX - atomic_load(&data->required_gen)));
+    wake_workers(data);
+    pthread_mutex_unlock(&data->mtx_gen);
+}
+
+/* Both the last worker at the barrier and every stripe that reaches
+ * required_gen broadcast cv_req_gen. */
+void finish_generations(workers_t* workers) {
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_gen);
+    while (get_earliest_gen(data) < data->required_gen) {
+        pthread_cond_wait(&data->cv_req_gen, &data->mtx_gen);
+    }
+    pthread_mutex_unlock(&data->mtx_gen);
+}
+
+void stop(field_t* field, workers_t* workers) {
+    struct workers_internal* data = workers->impl;
+    pthread_mutex_lock(&data->mtx_gen);
+    lower_gen_limit(data, &data->required_gen, atomic_load(&data->required_gen));
+    cancel_stable_request(data);
+    pthread_mutex_unlock(&data->mtx_gen);
+}
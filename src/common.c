@@ -1,19 +1,376 @@
 #include <interface.h>
+#include <kernel.h>
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Tries of copy_published_field, the last one being left to the caller. */
+#define kSnapshotTries 4
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+options_t options = {
+    .config_path = "game.config",
+    .tile_width = 0,
+    .tile_rows = 0,
+    .time_block = 1,
+    .track_activity = true,
+    .node_cache = 1 << 22,
+    .threads = 0,
+    .schedule = kScheduleSteal,
+    .halo_depth = 1,
+    .run_length_transfers = false,
+    .board_width = 0,
+    .board_height = 0,
+    .offset_x = 0,
+    .offset_y = 0,
+    .bench = kBenchNone,
+    .bench_generations = 0,
+    .density = 0.5,
+    .trace_path = NULL,
+    .rule = kConwayRule,
+    .rule_given = false,
+    .max_period = 1024,
+};
+
+#define kBenchSeed      0x9E3779B97F4A7C15ull
+
+typedef const char* (*option_parser_t)(const char* value);
+
+typedef struct {
+    const char* name;
+    const char* description;
+    option_parser_t parser;
+} option_t;
+
+static const char* parse_tile(const char* value) {
+    if (strcmp(value, "auto") == 0) {
+        options.tile_width = options.tile_rows = -1;
+        return NULL;
+    }
+    char tail;
+    if (sscanf(value, "%dx%d%c", &options.tile_width, &options.tile_rows, &tail) != 2 ||
+        options.tile_width <= 0 || options.tile_rows <= 0) {
+        return "--tile expects `auto` or <columns>x<rows>";
+    }
+    return NULL;
+}
+
+static const char* parse_time_block(const char* value) {
+    char tail;
+    if (sscanf(value, "%d%c", &options.time_block, &tail) != 1 ||
+        options.time_block < 1 || options.time_block > kCellsPerWord) {
+        return "--time-block expects an integer between 1 and 64";
+    }
+    return NULL;
+}
+
+static const char* parse_activity(const char* value) {
+    if (strcmp(value, "on") == 0 || strcmp(value, "off") == 0) {
+        options.track_activity = strcmp(value, "on") == 0;
+        return NULL;
+    }
+    return "--activity expects `on` or `off`";
+}
+
+static const char* parse_node_cache(const char* value) {
+    char tail;
+    if (sscanf(value, "%d%c", &options.node_cache, &tail) != 1 || options.node_cache <= 0) {
+        return "--node-cache expects a positive integer";
+    }
+    return NULL;
+}
+
+static const char* parse_threads(const char* value) {
+    char tail;
+    if (sscanf(value, "%d%c", &options.threads, &tail) != 1 || options.threads <= 0) {
+        return "--threads expects a positive integer";
+    }
+    return NULL;
+}
+
+static const char* parse_schedule(const char* value) {
+    if (strcmp(value, "steal") == 0 || strcmp(value, "wavefront") == 0) {
+        options.schedule = strcmp(value, "steal") == 0 ? kScheduleSteal : kScheduleWavefront;
+        return NULL;
+    }
+    return "--schedule expects `steal` or `wavefront`";
+}
+
+static const char* parse_halo(const char* value) {
+    if (strcmp(value, "auto") == 0) {
+        options.halo_depth = -1;
+        return NULL;
+    }
+    char tail;
+    if (sscanf(value, "%d%c", &options.halo_depth, &tail) != 1 ||
+        options.halo_depth < 1 || options.halo_depth > kCellsPerWord) {
+        return "--halo expects `auto` or an integer between 1 and 64";
+    }
+    return NULL;
+}
+
+static const char* parse_rle(const char* value) {
+    if (strcmp(value, "on") == 0 || strcmp(value, "off") == 0) {
+        options.run_length_transfers = strcmp(value, "on") == 0;
+        return NULL;
+    }
+    return "--rle expects `on` or `off`";
+}
+
+static const char* parse_board(const char* value) {
+    char tail;
+    if (sscanf(value, "%dx%d%c", &options.board_width, &options.board_height, &tail) != 2 ||
+        options.board_width <= 0 || options.board_height <= 0) {
+        return "--board expects <width>x<height>";
+    }
+    return NULL;
+}
+
+static const char* parse_offset(const char* value) {
+    char tail;
+    if (sscanf(value, "%d,%d%c", &options.offset_x, &options.offset_y, &tail) != 2 ||
+        options.offset_x < 0 || options.offset_y < 0) {
+        return "--offset expects <x>,<y> with non-negative coordinates";
+    }
+    return NULL;
+}
+
+static const char* parse_bench(const char* value) {
+    static const char* const kWorkloads[] = {"soup", "gliders", "oscillators"};
+    for (int i = 0; i < 3; ++i) {
+        if (strcmp(value, kWorkloads[i]) == 0) {
+            options.bench = kBenchSoup + i;
+            return NULL;
+        }
+    }
+    return "--bench expects `soup`, `gliders` or `oscillators`";
+}
+
+static const char* parse_generations(const char* value) {
+    char tail;
+    if (sscanf(value, "%d%c", &options.bench_generations, &tail) != 1 ||
+        options.bench_generations <= 0) {
+        return "--generations expects a positive integer";
+    }
+    return NULL;
+}
+
+static const char* parse_density(const char* value) {
+    char tail;
+    if (sscanf(value, "%lf%c", &options.density, &tail) != 1 ||
+        !(options.density >= 0 && options.density <= 1)) {
+        return "--density expects a number between 0 and 1";
+    }
+    return NULL;
+}
+
+static const char* parse_trace(const char* value) {
+    if (*value == '\0') {
+        return "--trace expects a file name";
+    }
+    options.trace_path = value;
+    return NULL;
+}
+
+static const char* parse_rule(const char* value) {
+    if (!parse_rulestring(value, strlen(value), &options.rule)) {
+        return "--rule expects a rule such as B3/S23";
+    }
+    options.rule_given = true;
+    return NULL;
+}
+
+static const char* parse_max_period(const char* value) {
+    char tail;
+    if (sscanf(value, "%d%c", &options.max_period, &tail) != 1 || options.max_period <= 0) {
+        return "--max-period expects a positive integer";
+    }
+    return NULL;
+}
+
+static const option_t kOptions[] = {
+    {"tile",       "walk the board in <columns>x<rows> tiles, or `auto`", parse_tile},
+    {"time-block", "advance each tile #N generations per pass",          parse_time_block},
+    {"activity",   "`on` to skip tiles with no changes around (default)", parse_activity},
+    {"node-cache", "collect HashLife nodes once there are more than #N",  parse_node_cache},
+    {"threads",    "compute with #N worker threads (default: one per CPU)", parse_threads},
+    {"schedule",   "`steal` tiles or run a `wavefront` (no run-until-stable)", parse_schedule},
+    {"halo",       "exchange MPI halos every #N generations, or `auto`", parse_halo},
+    {"rle",        "`on` to run-length encode MPI transfers",            parse_rle},
+    {"board",      "board size <width>x<height> for RLE and .cells patterns", parse_board},
+    {"offset",     "place the pattern's corner at cell <x>,<y>",         parse_offset},
+    {"bench",      "time a `soup`, `gliders` or `oscillators` workload", parse_bench},
+    {"generations", "length of the --bench run (default: by board size)", parse_generations},
+    {"density",    "share of live cells in the --bench soup (0.5)",      parse_density},
+    {"trace",      "append the `stats` counters to CSV file #F every second", parse_trace},
+    {"rule",       "life-like rule such as B36/S23 (default: B3/S23)",   parse_rule},
+    {"max-period", "longest cycle run-until-stable looks for (1024)",    parse_max_period},
+};
+
+static const int kOptionsCount = sizeof(kOptions) / sizeof(option_t);
+
+const char* parse_options(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            options.config_path = argv[i];
+            continue;
+        }
+
+        const char* name = argv[i] + 2;
+        const char* value = strchr(name, '=');
+        size_t name_length = value == NULL ? strlen(name) : (size_t)(value - name);
+        value = value == NULL ? "" : value + 1;
+
+        bool option_found = false;
+        for (int j = 0; j < kOptionsCount && !option_found; ++j) {
+            if (strlen(kOptions[j].name) == name_length &&
+                strncmp(kOptions[j].name, name, name_length) == 0) {
+                option_found = true;
+                const char* err_msg = kOptions[j].parser(value);
+                if (err_msg != NULL) {
+                    return err_msg;
+                }
+            }
+        }
+        if (!option_found) {
+            return "Unknown command line option";
+        }
+    }
+    return NULL;
+}
+
+void print_options_help() {
+    printf("# Command line options:\n");
+    for (int i = 0; i < kOptionsCount; ++i) {
+        printf("# --%-12s - %s\n", kOptions[i].name, kOptions[i].description);
+    }
+}
 
 void init_field(field_t* field, int width, int height) {
     field->width = width;
     field->height = height;
-    field->buffer = calloc(field->width * field->height, sizeof(bool));
+    field->words = (height + kCellsPerWord - 1) / kCellsPerWord;
+    field->stride = field->words + 2;
+#ifdef _OPENMP
+    /* Pages go to the NUMA node of the thread that touches them first. The
+     * static split of columns follows the static split of tile columns in
+     * the OpenMP backend, so every thread zeroes what it computes later. */
+    field->storage = malloc((size_t)(field->width + 2) * field->stride * sizeof(uint64_t));
+    #pragma omp parallel for schedule(static) if(!omp_in_parallel())
+    for (int x = 0; x < field->width + 2; ++x) {
+        memset(field->storage + (size_t)x * field->stride, 0, field->stride * sizeof(uint64_t));
+    }
+#else
+    field->storage = calloc((size_t)(field->width + 2) * field->stride, sizeof(uint64_t));
+#endif
+    field->buffer = field->storage + field->stride + 1;
+}
+
+bool parse_rulestring(const char* text, size_t length, rule_t* rule) {
+    rule_t parsed = {0, 0};
+    const bool tagged = length > 0 && strchr("BbSs", text[0]) != NULL;
+    bool birth_seen = false, survive_seen = false, slash_seen = false;
+    /* Where the digits go: S/B without the letters. */
+    uint16_t* mask = &parsed.survive;
+    for (size_t i = 0; i < length; ++i) {
+        const char c = text[i];
+        if (tagged && (c == 'B' || c == 'b') && !birth_seen) {
+            birth_seen = true;
+            mask = &parsed.birth;
+        } else if (tagged && (c == 'S' || c == 's') && !survive_seen) {
+            survive_seen = true;
+            mask = &parsed.survive;
+        } else if (c == '/' && !slash_seen) {
+            slash_seen = true;
+            mask = tagged ? NULL : &parsed.birth;
+        } else if (c >= '0' && c <= '8' && mask != NULL) {
+            *mask |= 1 << (c - '0');
+        } else {
+            return false;
+        }
+    }
+    if (tagged ? !birth_seen || !survive_seen : !slash_seen) {
+        return false;
+    }
+    *rule = parsed;
+    return true;
+}
+
+void format_rule(rule_t rule, char buffer[kMaxRuleLength]) {
+    char* out = buffer;
+    *out++ = 'B';
+    for (int n = 0; n <= 8; ++n) {
+        if (get_next_state(rule, false, n)) {
+            *out++ = '0' + n;
+        }
+    }
+    *out++ = '/';
+    *out++ = 'S';
+    for (int n = 0; n <= 8; ++n) {
+        if (get_next_state(rule, true, n)) {
+            *out++ = '0' + n;
+        }
+    }
+    *out = '\0';
+}
+
+/* Workloads are the same from run to run: the soup comes from a fixed seed,
+ * the gliders all fly the same way in 32x32 squares and never meet, and the
+ * blinkers sit in a 4x4 lattice where they never touch. */
+const char* setup_bench_field(field_t* field) {
+    const int width = options.board_width > 0 ? options.board_width : kBenchBoardSide;
+    const int height = options.board_height > 0 ? options.board_height : kBenchBoardSide;
+    init_field(field, width, height);
+
+    if (options.bench == kBenchSoup) {
+        const uint64_t threshold = (uint64_t)(options.density * (double)UINT32_MAX);
+        uint64_t state = kBenchSeed;
+        for (int x = 0; x < width; ++x) {
+            for (int y = 0; y < height; ++y) {
+                state ^= state << 13;
+                state ^= state >> 7;
+                state ^= state << 17;
+                if ((state >> 32) < threshold) {
+                    set_cell(field, x, y, true);
+                }
+            }
+        }
+    } else if (options.bench == kBenchGliders) {
+        static const int kGlider[5][2] = {{1, 0}, {2, 1}, {0, 2}, {1, 2}, {2, 2}};
+        for (int x = 0; x + 32 <= width; x += 32) {
+            for (int y = 0; y + 32 <= height; y += 32) {
+                for (int i = 0; i < 5; ++i) {
+                    set_cell(field, x + 1 + kGlider[i][0], y + 1 + kGlider[i][1], true);
+                }
+            }
+        }
+    } else {
+        for (int x = 0; x + 4 <= width; x += 4) {
+            for (int y = 1; y + 3 <= height; y += 4) {
+                for (int i = 0; i < 3; ++i) {
+                    set_cell(field, x + i, y, true);
+                }
+            }
+        }
+    }
+
+    refresh_halo(field);
+    return NULL;
 }
 
-const char* setup_field(int argc, char* argv[], field_t* field) {
-    const char* filename = "game.config";
-    if (argc >= 2) {
-        filename = argv[1];
+const char* setup_field(const char* filename, field_t* field) {
+    if (options.bench != kBenchNone) {
+        return setup_bench_field(field);
     }
 
     FILE* f = fopen(filename, "r");
@@ -21,30 +378,322 @@ const char* setup_field(int argc, char* argv[], field_t* field) {
         return strerror(errno);
     }
 
+    snapshot_header_t header;
+    if (fread(&header, sizeof(header), 1, f) == 1 &&
+        memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) == 0) {
+        fclose(f);
+        if (header.width <= 0 || header.height <= 0 ||
+            header.width > INT32_MAX || header.height > INT32_MAX) {
+            return "Ill-formed snapshot file";
+        }
+        init_field(field, (int)header.width, (int)header.height);
+        const char* err_msg = load_snapshot(filename, field, NULL);
+        if (err_msg != NULL) {
+            destroy_field(field);
+        }
+        return err_msg;
+    }
+    rewind(f);
+
+    /* RLE starts with `#` comments or the `x = ` header, plaintext with `!`
+     * comments or a row of cells; the native format starts with a number. */
+    char first = ' ';
+    if (fscanf(f, " %c", &first) == 1 && strchr("#x!.O*", first) != NULL) {
+        fclose(f);
+        return load_pattern(filename, field);
+    }
+    rewind(f);
+
     int num_of_cells = 0;
     int width = 0, height = 0;
-    if (fscanf(f, "%d%d%d", &width, &height, &num_of_cells) != 3) {
+    if (fscanf(f, "%d%d%d", &width, &height, &num_of_cells) != 3 ||
+        width <= 0 || height <= 0 || num_of_cells < 0) {
         fclose(f);
         return "Ill-formed configuration file";
     }
+    /* The first line may end with a rule. Cells may follow on the same line,
+     * so a number is put back unless it is a survival-first `23/3`. */
+    const long rule_position = ftell(f);
+    char rule[kMaxRuleLength];
+    if (fscanf(f, "%*[ \t]%23[^ \t\r\n]", rule) == 1 &&
+        (strchr("BbSs", rule[0]) != NULL || strchr(rule, '/') != NULL)) {
+        if (!options.rule_given && !parse_rulestring(rule, strlen(rule), &options.rule)) {
+            fclose(f);
+            return "Unknown rule in configuration file";
+        }
+    } else {
+        fseek(f, rule_position, SEEK_SET);
+    }
 
     init_field(field, width, height);
 
     for (int i = 0; i < num_of_cells; ++i) {
         int x = 0, y = 0;
         if (fscanf(f, "%d%d", &x, &y) != 2) {
-            free(field->buffer);
+            destroy_field(field);
             fclose(f);
             return "Ill-formed configuration file";
         }
-        *get_cell(field, x, y) = true;
+        if (x < 0 || x >= width || y < 0 || y >= height) {
+            destroy_field(field);
+            fclose(f);
+            return "Cell outside of the board in configuration file";
+        }
+        set_cell(field, x, y, true);
     }
 
     fclose(f);
+    refresh_halo(field);
     return NULL;
 }
 
 void destroy_field(field_t* field) {
-    free(field->buffer);
-    field->width = field->height = 0;
+    free(field->storage);
+    field->storage = field->buffer = NULL;
+    field->width = field->height = field->words = field->stride = 0;
+}
+
+void copy_field(field_t* to, const field_t* from) {
+    memcpy(to->storage, from->storage,
+           (size_t)(from->width + 2) * from->stride * sizeof(uint64_t));
+}
+
+void print_field(const field_t* field, long long generation) {
+    printf("# Current iteration: %lld\n", generation);
+    char* row = malloc(field->width + 3);
+    row[0] = '#';
+    row[1] = ' ';
+    row[field->width + 2] = '\n';
+    for (int y = 0; y < field->height; ++y) {
+        for (int x = 0; x < field->width; ++x) {
+            row[x + 2] = get_cell(field, x, y) ? 'O' : '_';
+        }
+        fwrite(row, 1, field->width + 3, stdout);
+    }
+    free(row);
+}
+
+bool scan_path(char path[kMaxPathLength]) {
+    /* Width is kMaxPathLength - 1. */
+    if (scanf("%4095s", path) != 1) {
+        printf("# File name expected\n");
+        return false;
+    }
+    return true;
+}
+
+static bool expect_positive(bool positive) {
+    if (!positive) {
+        printf("# Positive integer expected\n");
+    }
+    return positive;
+}
+
+bool scan_count(int* generations) {
+    return expect_positive(scanf("%d", generations) == 1 && *generations > 0);
+}
+
+bool scan_limit(int* generations) {
+    char line[32];
+    *generations = 0;
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+        return true;
+    }
+    char tail;
+    int count = sscanf(line, "%d %c", generations, &tail);
+    return expect_positive(count == EOF || (count == 1 && *generations > 0));
+}
+
+void init_cycle_detector(cycle_detector_t* detector) {
+    detector->hashes = malloc(options.max_period * sizeof(uint64_t));
+    detector->count = detector->next = 0;
+}
+
+void destroy_cycle_detector(cycle_detector_t* detector) {
+    free(detector->hashes);
+    detector->hashes = NULL;
+}
+
+int detect_cycle(cycle_detector_t* detector, uint64_t hash) {
+    const int size = options.max_period;
+    int period = 0;
+    for (int p = 1; p <= detector->count && period == 0; ++p) {
+        if (detector->hashes[(detector->next - p + size) % size] == hash) {
+            period = p;
+        }
+    }
+    detector->hashes[detector->next] = hash;
+    detector->next = (detector->next + 1) % size;
+    detector->count += detector->count < size;
+    return period;
+}
+
+void print_cycle(long long generation, int period) {
+    if (period == 0) {
+        printf("# No cycle of period up to %d by generation %lld\n",
+               options.max_period, generation);
+    } else if (period == 1) {
+        printf("# Still life from generation %lld\n", generation - 1);
+    } else {
+        printf("# Period %d cycle from generation %lld\n", period, generation - period);
+    }
+    fflush(stdout);
+}
+
+void make_snapshot_header(snapshot_header_t* header, const field_t* field, long long generation) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, kSnapshotMagic, sizeof(header->magic));
+    header->version = kSnapshotVersion;
+    header->header_size = sizeof(*header);
+    header->width = field->width;
+    header->height = field->height;
+    header->generation = generation;
+}
+
+/* Bits of the last word past the last row hold ghost cells, which are
+ * written as zeros. */
+const char* save_snapshot(const char* filename, const field_t* field, long long generation) {
+    FILE* f = fopen(filename, "wb");
+    if (f == NULL) {
+        return strerror(errno);
+    }
+
+    snapshot_header_t header;
+    make_snapshot_header(&header, field, generation);
+    bool written = fwrite(&header, sizeof(header), 1, f) == 1;
+    const uint64_t tail_mask = get_tail_mask(field);
+    for (int x = 0; x < field->width && written; ++x) {
+        const uint64_t* column = get_column(field, x);
+        uint64_t last_word = column[field->words - 1] & tail_mask;
+        written = fwrite(column, sizeof(uint64_t), field->words - 1, f) ==
+                  (size_t)field->words - 1 &&
+                  fwrite(&last_word, sizeof(uint64_t), 1, f) == 1;
+    }
+
+    if (fclose(f) != 0 || !written) {
+        return "Cannot write snapshot file";
+    }
+    return NULL;
+}
+
+const char* check_snapshot_header(const snapshot_header_t* header, const field_t* field,
+                                  size_t file_size) {
+    const size_t data_size = (size_t)field->width * field->words * sizeof(uint64_t);
+    if (memcmp(header->magic, kSnapshotMagic, sizeof(header->magic)) != 0) {
+        return "Ill-formed snapshot file";
+    } else if (header->version != kSnapshotVersion) {
+        return "Unsupported snapshot version";
+    } else if (header->width != field->width || header->height != field->height) {
+        return "Snapshot size does not match the board";
+    } else if (file_size < header->header_size + data_size) {
+        return "Truncated snapshot file";
+    }
+    return NULL;
+}
+
+const char* load_snapshot(const char* filename, field_t* field, long long* generation) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return strerror(errno);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(snapshot_header_t)) {
+        close(fd);
+        return "Ill-formed snapshot file";
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return strerror(errno);
+    }
+
+    const snapshot_header_t* header = map;
+    const char* err_msg = check_snapshot_header(header, field, st.st_size);
+    if (err_msg != NULL) {
+        munmap(map, st.st_size);
+        return err_msg;
+    }
+
+    const uint64_t* words = (const uint64_t*)((const char*)map + header->header_size);
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    const uint64_t tail_mask = get_tail_mask(field);
+    for (int x = 0; x < field->width; ++x) {
+        uint64_t* column = get_column(field, x);
+        memcpy(column, words + (size_t)x * field->words, field->words * sizeof(uint64_t));
+        column[field->words - 1] &= tail_mask;
+    }
+    if (generation != NULL) {
+        *generation = header->generation;
+    }
+    munmap(map, st.st_size);
+    refresh_halo(field);
+    return NULL;
+}
+
+bool copy_published_field(field_t* snapshot, field_t* const* field, const int* generation,
+                          const int* gen_shift, atomic_int* epoch, pthread_mutex_t* mtx,
+                          int* gen) {
+    for (int i = 1; i < kSnapshotTries; ++i) {
+        pthread_mutex_lock(mtx);
+        const int start_epoch = atomic_load(epoch);
+        *gen = *generation + *gen_shift;
+        const field_t* current_field = *field;
+        pthread_mutex_unlock(mtx);
+
+        copy_field(snapshot, current_field);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(epoch, memory_order_relaxed) == start_epoch) {
+            return true;
+        }
+    }
+    return false;
+}
+
+long long get_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+void print_stats(const stats_t* stats) {
+    const double passes = stats->passes > 0 ? stats->passes : 1;
+    const double snapshots = stats->snapshots > 0 ? stats->snapshots : 1;
+    printf("# Generation: %lld\n", stats->generation);
+    printf("# Passes: %lld, %.1f us on average, %.1f us at most\n",
+           stats->passes, stats->pass_ns * 1e-3 / passes, stats->max_pass_ns * 1e-3);
+    printf("# Workers: %d, busy %.3f s, waiting %.3f s, idle %.3f s\n", stats->workers,
+           stats->busy_ns * 1e-9, stats->wait_ns * 1e-9, stats->idle_ns * 1e-9);
+    printf("# Dumps and saves: %lld, %.1f us on average\n",
+           stats->snapshots, stats->snapshot_ns * 1e-3 / snapshots);
+    if (stats->messages > 0) {
+        printf("# MPI messages: %lld, %lld bytes\n", stats->messages, stats->bytes);
+    }
+}
+
+static FILE* trace_file = NULL;
+static long long trace_start_ns, next_trace_ns;
+
+bool is_trace_due() {
+    return options.trace_path != NULL && get_time_ns() >= next_trace_ns;
+}
+
+void write_trace(const stats_t* stats) {
+    const long long now = get_time_ns();
+    if (trace_file == NULL) {
+        trace_file = fopen(options.trace_path, "a");
+        if (trace_file == NULL) {
+            fprintf(stderr, "# Cannot open %s: %s\n", options.trace_path, strerror(errno));
+            options.trace_path = NULL;
+            return;
+        }
+        trace_start_ns = now;
+        fprintf(trace_file, "seconds,generation,workers,passes,pass_ns,max_pass_ns,busy_ns,"
+                            "wait_ns,idle_ns,snapshots,snapshot_ns,messages,bytes\n");
+    }
+    fprintf(trace_file, "%.3f,%lld,%d,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld\n",
+            (now - trace_start_ns) * 1e-9, stats->generation, stats->workers, stats->passes,
+            stats->pass_ns, stats->max_pass_ns, stats->busy_ns, stats->wait_ns, stats->idle_ns,
+            stats->snapshots, stats->snapshot_ns, stats->messages, stats->bytes);
+    fflush(trace_file);
+    next_trace_ns = now + 1000000000ll;
 }
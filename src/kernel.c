@@ -0,0 +1,584 @@
+#include <kernel.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Bit-sliced adders: every bit position is an independent lane. `sum` must
+ * not alias any of the inputs. */
+#define HALF_ADD(sum, carry, a, b)      \
+    sum = (a) ^ (b);                    \
+    carry = (a) & (b);
+
+#define FULL_ADD(sum, carry, a, b, c)   \
+    sum = (a) ^ (b);                    \
+    carry = ((a) & (b)) | (sum & (c));  \
+    sum ^= (c);
+
+/* Bits 0-1 (s0, s1) and the carry bits (t1, c1) of the neighbor counts
+ * of every lane. */
+#define COUNT_NEIGHBORS(type)                                               \
+    type x0, x1, y0, y1, z0, z1;                                            \
+    FULL_ADD(x0, x1, l_up, l, l_down);                                      \
+    FULL_ADD(y0, y1, r_up, r, r_down);                                      \
+    HALF_ADD(z0, z1, c_up, c_down);                                         \
+                                                                            \
+    type s0, c0, t0, t1, s1, c1;                                            \
+    FULL_ADD(s0, c0, x0, y0, z0);                                           \
+    FULL_ADD(t0, t1, x1, y1, z1);                                           \
+    HALF_ADD(s1, c1, t0, c0);
+
+/* Takes the eight neighbor words and the cell word itself, returns the next
+ * state of every cell. For B3/S23 the neighbor count is only kept modulo 8,
+ * which is enough to tell 2 and 3 apart from everything else. */
+#define DEFINE_LIFE_WORD(name, type, attributes)                            \
+attributes static inline type name(type l_up, type l, type l_down,          \
+                                   type c_up, type c, type c_down,          \
+                                   type r_up, type r, type r_down) {        \
+    COUNT_NEIGHBORS(type)                                                   \
+    type s2 = t1 ^ c1;                                                      \
+                                                                            \
+    return s1 & ~s2 & (s0 | c);                                             \
+}
+
+/* Any other rule: the full count (s3 is set for 8) is compared against
+ * every count the rule has an outcome for, see rule_table. */
+#define DEFINE_RULE_WORD(name, type, attributes)                            \
+attributes static inline type name(type l_up, type l, type l_down,          \
+                                   type c_up, type c, type c_down,          \
+                                   type r_up, type r, type r_down) {        \
+    COUNT_NEIGHBORS(type)                                                   \
+    type s2 = t1 ^ c1;                                                      \
+    type s3 = t1 & c1;                                                      \
+                                                                            \
+    type next = (type){0};                                                  \
+    for (int i = 0; i < rule_table.terms; ++i) {                            \
+        const uint64_t* bits = rule_table.count_bits[i];                    \
+        type match = ~((s0 ^ bits[0]) | (s1 ^ bits[1]) |                    \
+                       (s2 ^ bits[2]) | (s3 ^ bits[3]));                    \
+        next |= match & ((c & rule_table.if_alive[i]) |                     \
+                         (~c & rule_table.if_dead[i]));                     \
+    }                                                                       \
+    return next;                                                            \
+}
+
+/* The neighbor-count lookup table of a rule other than B3/S23, kept to the
+ * counts that give a live cell either way. Every entry is a word of copies
+ * of one bit: bit j of the count and whether a dead and a live cell with
+ * that count are alive next. */
+static struct {
+    int terms;
+    uint64_t count_bits[9][4];
+    uint64_t if_dead[9], if_alive[9];
+} rule_table;
+
+static bool conway_rule = true;
+
+DEFINE_LIFE_WORD(life_word, uint64_t, )
+DEFINE_RULE_WORD(rule_word, uint64_t, )
+
+/* Both neighbors of a bit come from the ghost words at the column ends, so
+ * neither the first nor the last word needs special handling. */
+#define DEFINE_STEP_WORD(name, word)                                        \
+static inline uint64_t name(const uint64_t* left, const uint64_t* mid,      \
+                            const uint64_t* right, int w) {                 \
+    return word((left[w] << 1) | (left[w - 1] >> 63), left[w],              \
+                (left[w] >> 1) | (left[w + 1] << 63),                       \
+                (mid[w] << 1) | (mid[w - 1] >> 63), mid[w],                 \
+                (mid[w] >> 1) | (mid[w + 1] << 63),                         \
+                (right[w] << 1) | (right[w - 1] >> 63), right[w],           \
+                (right[w] >> 1) | (right[w + 1] << 63));                    \
+}
+
+DEFINE_STEP_WORD(step_word, life_word)
+DEFINE_STEP_WORD(step_rule_word, rule_word)
+
+typedef void (*column_kernel_t)(const uint64_t* left, const uint64_t* mid,
+                                const uint64_t* right, uint64_t* out, int words);
+
+static void step_column_scalar(const uint64_t* left, const uint64_t* mid,
+                               const uint64_t* right, uint64_t* out, int words) {
+    for (int w = 0; w < words; ++w) {
+        out[w] = step_word(left, mid, right, w);
+    }
+}
+
+static void step_column_scalar_rule(const uint64_t* left, const uint64_t* mid,
+                                    const uint64_t* right, uint64_t* out, int words) {
+    for (int w = 0; w < words; ++w) {
+        out[w] = step_rule_word(left, mid, right, w);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* A plain stencil over `lanes` consecutive words, read with unaligned loads
+ * at w - 1 and w + 1; the words that do not fill a vector are left to the
+ * scalar code. */
+#define DEFINE_COLUMN_LOOP(name, vec_t, load, word, scalar_word, lanes, attributes) \
+attributes static void name(const uint64_t* left, const uint64_t* mid,      \
+                            const uint64_t* right, uint64_t* out,           \
+                            int words) {                                    \
+    int w = 0;                                                              \
+    for (; w + (lanes) <= words; w += (lanes)) {                            \
+        vec_t l = load(left + w);                                           \
+        vec_t c = load(mid + w);                                            \
+        vec_t r = load(right + w);                                          \
+        vec_t v = word((l << 1) | (load(left + w - 1) >> 63), l,            \
+                       (l >> 1) | (load(left + w + 1) << 63),               \
+                       (c << 1) | (load(mid + w - 1) >> 63), c,             \
+                       (c >> 1) | (load(mid + w + 1) << 63),                \
+                       (r << 1) | (load(right + w - 1) >> 63), r,           \
+                       (r >> 1) | (load(right + w + 1) << 63));             \
+        memcpy(out + w, &v, sizeof(v));                                     \
+    }                                                                       \
+    for (; w < words; ++w) {                                                \
+        out[w] = scalar_word(left, mid, right, w);                          \
+    }                                                                       \
+}
+
+/* `name` for B3/S23 and `name`_rule for any other rule. */
+#define DEFINE_COLUMN_KERNEL(name, lanes, attributes)                       \
+typedef uint64_t name##_vec_t __attribute__((vector_size((lanes) * 8)));    \
+DEFINE_LIFE_WORD(name##_life, name##_vec_t, attributes)                     \
+DEFINE_RULE_WORD(name##_rule_word, name##_vec_t, attributes)                \
+                                                                            \
+attributes static inline name##_vec_t name##_load(const uint64_t* p) {      \
+    name##_vec_t v;                                                         \
+    memcpy(&v, p, sizeof(v));                                               \
+    return v;                                                               \
+}                                                                           \
+                                                                            \
+DEFINE_COLUMN_LOOP(name, name##_vec_t, name##_load, name##_life,            \
+                   step_word, lanes, attributes)                            \
+DEFINE_COLUMN_LOOP(name##_rule, name##_vec_t, name##_load, name##_rule_word, \
+                   step_rule_word, lanes, attributes)
+
+DEFINE_COLUMN_KERNEL(step_column_sse2,   2, __attribute__((target("sse2"))))
+DEFINE_COLUMN_KERNEL(step_column_avx2,   4, __attribute__((target("avx2"))))
+DEFINE_COLUMN_KERNEL(step_column_avx512, 8, __attribute__((target("avx512f"))))
+
+#endif
+
+typedef struct {
+    const char* name;
+    const char* cpu_feature;
+    column_kernel_t kernel;
+    column_kernel_t rule_kernel;
+} kernel_descr_t;
+
+/* Ordered from the most to the least preferred one. */
+static const kernel_descr_t kKernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    {"avx512", "avx512f", step_column_avx512, step_column_avx512_rule},
+    {"avx2",   "avx2",    step_column_avx2,   step_column_avx2_rule},
+    {"sse2",   "sse2",    step_column_sse2,   step_column_sse2_rule},
+#endif
+    {"scalar", NULL,      step_column_scalar, step_column_scalar_rule},
+};
+
+static const int kKernelsCount = sizeof(kKernels) / sizeof(kernel_descr_t);
+
+static const kernel_descr_t* kernel = &kKernels[sizeof(kKernels) / sizeof(kernel_descr_t) - 1];
+
+static bool cpu_supports(const char* feature) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (strcmp(feature, "avx512f") == 0) {
+        return __builtin_cpu_supports("avx512f");
+    }
+    if (strcmp(feature, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2");
+    }
+    if (strcmp(feature, "sse2") == 0) {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return false;
+}
+
+const char* setup_kernel() {
+    const char* requested = getenv("GAME_KERNEL");
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+#endif
+
+    for (int i = 0; i < kKernelsCount; ++i) {
+        if (requested != NULL && strcmp(requested, kKernels[i].name) != 0) {
+            continue;
+        }
+        if (kKernels[i].cpu_feature == NULL || cpu_supports(kKernels[i].cpu_feature)) {
+            kernel = &kKernels[i];
+            return NULL;
+        }
+        if (requested != NULL) {
+            return "Requested kernel is not supported by this CPU";
+        }
+    }
+
+    return requested == NULL ? NULL : "Unknown kernel requested in GAME_KERNEL";
+}
+
+const char* get_kernel_name() {
+    return kernel->name;
+}
+
+void setup_rule() {
+    const rule_t rule = options.rule;
+    conway_rule = rule.birth == kConwayRule.birth && rule.survive == kConwayRule.survive;
+    rule_table.terms = 0;
+    for (int count = 0; count <= 8; ++count) {
+        const bool born = get_next_state(rule, false, count);
+        const bool survives = get_next_state(rule, true, count);
+        if (!born && !survives) {
+            continue;
+        }
+        const int i = rule_table.terms++;
+        for (int bit = 0; bit < 4; ++bit) {
+            rule_table.count_bits[i][bit] = (count >> bit) & 1 ? ~(uint64_t)0 : 0;
+        }
+        rule_table.if_dead[i] = born ? ~(uint64_t)0 : 0;
+        rule_table.if_alive[i] = survives ? ~(uint64_t)0 : 0;
+    }
+}
+
+void step_block(const field_t* field, field_t* next_field, int from_x, int to_x,
+                int from_w, int to_w) {
+    const bool last_word = to_w == field->words - 1;
+    const uint64_t tail_mask = get_tail_mask(field);
+    const column_kernel_t step_column = conway_rule ? kernel->kernel : kernel->rule_kernel;
+
+    for (int x = from_x; x <= to_x; ++x) {
+        uint64_t* out = get_column(next_field, x);
+        step_column(get_column(field, x - 1) + from_w, get_column(field, x) + from_w,
+                    get_column(field, x + 1) + from_w, out + from_w, to_w - from_w + 1);
+        if (last_word) {
+            out[to_w] &= tail_mask;
+        }
+    }
+}
+
+void step_columns(const field_t* field, field_t* next_field, int from_x, int to_x) {
+    step_block(field, next_field, from_x, to_x, 0, field->words - 1);
+}
+
+void refresh_vertical_halo(field_t* field, int from_x, int to_x) {
+    const int words = field->words;
+    const int tail = (field->height - 1) % kCellsPerWord;
+    const uint64_t tail_mask = get_tail_mask(field);
+
+    for (int x = from_x; x <= to_x; ++x) {
+        uint64_t* column = get_column(field, x);
+        uint64_t first = column[0] & 1;
+        uint64_t last = column[words - 1] & tail_mask;
+
+        column[-1] = ((last >> tail) & 1) << 63;
+        if (tail == kCellsPerWord - 1) {
+            column[words] = first;
+        } else {
+            column[words - 1] = last | (first << (tail + 1));
+            column[words] = 0;
+        }
+    }
+}
+
+void refresh_horizontal_halo(field_t* field) {
+    const int width = field->width;
+    memcpy(get_column(field, -1) - 1, get_column(field, width - 1) - 1,
+           field->stride * sizeof(uint64_t));
+    memcpy(get_column(field, width) - 1, get_column(field, 0) - 1,
+           field->stride * sizeof(uint64_t));
+}
+
+void refresh_halo(field_t* field) {
+    refresh_vertical_halo(field, 0, field->width - 1);
+    refresh_horizontal_halo(field);
+}
+
+#define kDefaultCacheSize (256 * 1024)
+#define kAutoTileWords 32
+#define kMinTileWidth 8
+#define kActivityTileWidth 64
+#define kActivityTileWords 8
+
+tiling_t make_tiling(const field_t* field) {
+    tiling_t tiling = {
+        .width = options.tile_width,
+        .words = options.tile_rows,
+        .depth = options.time_block,
+    };
+
+    if (tiling.width < 0 || (tiling.width == 0 && tiling.depth > 1)) {
+        /* Two scratch buffers of a tile and its halo should take no more than
+         * a half of L2, leaving the rest for the source columns. */
+        long cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        if (cache_size <= 0) {
+            cache_size = kDefaultCacheSize;
+        }
+        int words = kAutoTileWords < field->words ? kAutoTileWords : field->words;
+        int width = cache_size / 2 / (2 * (words + 4) * (int)sizeof(uint64_t))
+                    - 2 * tiling.depth - 2;
+        tiling.width = width < kMinTileWidth ? kMinTileWidth : width;
+        tiling.words = words;
+    } else if (tiling.width == 0 && options.track_activity) {
+        tiling.width = kActivityTileWidth;
+        tiling.words = kActivityTileWords;
+    } else if (tiling.width > 0) {
+        tiling.words = (tiling.words + kCellsPerWord - 1) / kCellsPerWord;
+    }
+
+    /* A change must not travel further than the neighboring tile in a pass. */
+    if (tiling.width < tiling.depth) {
+        tiling.width = tiling.depth;
+    }
+    if (tiling.width == 0 || tiling.width > field->width) {
+        tiling.width = field->width;
+    }
+    if (tiling.words == 0 || tiling.words > field->words) {
+        tiling.words = field->words;
+    }
+
+    tiling.columns = field->width / tiling.width;
+    tiling.rows = field->words / tiling.words;
+    tiling.board_width = field->width;
+    tiling.board_words = field->words;
+    return tiling;
+}
+
+void init_tile_scratch(tile_scratch_t* scratch, const tiling_t* tiling) {
+    if (tiling->depth <= 1) {
+        scratch->buffers[0].storage = scratch->buffers[1].storage = NULL;
+        return;
+    }
+    /* The last tile of a row or a column is the largest one. */
+    int width = tiling->board_width - (tiling->columns - 1) * tiling->width;
+    int words = tiling->board_words - (tiling->rows - 1) * tiling->words;
+    for (int i = 0; i < 2; ++i) {
+        init_field(&scratch->buffers[i], width + 2 * tiling->depth,
+                   (words + 2) * kCellsPerWord);
+    }
+}
+
+void destroy_tile_scratch(tile_scratch_t* scratch) {
+    if (scratch->buffers[0].storage != NULL) {
+        destroy_field(&scratch->buffers[0]);
+        destroy_field(&scratch->buffers[1]);
+    }
+}
+
+void init_activity(activity_t* activity, const tiling_t* tiling) {
+    size_t tiles = (size_t)tiling->columns * tiling->rows;
+    activity->changed = malloc(tiles);
+    activity->next_changed = malloc(tiles);
+    activity->hashes = calloc(tiles, sizeof(uint64_t));
+    activity->hashing = false;
+    memset(activity->changed, 1, tiles);
+    memset(activity->next_changed, 1, tiles);
+    activity->flags_depth = activity->pass_depth = 1;
+    activity->all_active = true;
+}
+
+void reset_activity(activity_t* activity, const tiling_t* tiling) {
+    size_t tiles = (size_t)tiling->columns * tiling->rows;
+    memset(activity->changed, 1, tiles);
+    memset(activity->next_changed, 1, tiles);
+    activity->flags_depth = activity->pass_depth = 1;
+    activity->all_active = true;
+}
+
+void destroy_activity(activity_t* activity) {
+    free(activity->changed);
+    free(activity->next_changed);
+    free(activity->hashes);
+}
+
+/* splitmix64's finalizer over the word and its position. */
+static inline uint64_t hash_word(uint64_t word, uint64_t position) {
+    uint64_t z = word + position * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+uint64_t hash_block(const field_t* field, int from_x, int to_x, int from_w, int to_w,
+                    uint64_t last_mask, int dx, int dw, int board_words) {
+    uint64_t hash = 0;
+    for (int x = from_x; x <= to_x; ++x) {
+        const uint64_t* column = get_column(field, x);
+        const uint64_t first = (uint64_t)(x + dx) * board_words + dw;
+        for (int w = from_w; w < to_w; ++w) {
+            hash += hash_word(column[w], first + w);
+        }
+        hash += hash_word(column[to_w] & last_mask, first + to_w);
+    }
+    return hash;
+}
+
+static uint64_t hash_tile(const field_t* field, const tiling_t* tiling, int column, int row) {
+    const int to_w = row == tiling->rows - 1 ? field->words - 1
+                                             : (row + 1) * tiling->words - 1;
+    return hash_block(field, get_tile_from_x(tiling, column), get_tile_to_x(tiling, column),
+                      row * tiling->words, to_w,
+                      to_w == field->words - 1 ? get_tail_mask(field) : ~(uint64_t)0,
+                      0, 0, field->words);
+}
+
+void start_hashing(activity_t* activity, const tiling_t* tiling, const field_t* field) {
+    reset_activity(activity, tiling);
+    for (int column = 0; column < tiling->columns; ++column) {
+        for (int row = 0; row < tiling->rows; ++row) {
+            activity->hashes[column * tiling->rows + row] = hash_tile(field, tiling, column, row);
+        }
+    }
+    activity->hashing = true;
+}
+
+void stop_hashing(activity_t* activity) {
+    activity->hashing = false;
+}
+
+uint64_t get_board_hash(const activity_t* activity, const tiling_t* tiling) {
+    uint64_t hash = 0;
+    for (int i = 0; i < tiling->columns * tiling->rows; ++i) {
+        hash += activity->hashes[i];
+    }
+    return hash;
+}
+
+void begin_activity_pass(activity_t* activity, int depth) {
+    activity->all_active = activity->flags_depth != 1 && activity->flags_depth != depth;
+    activity->pass_depth = depth;
+}
+
+void finish_activity_pass(activity_t* activity) {
+    uint8_t* temp = activity->changed;
+    activity->changed = activity->next_changed;
+    activity->next_changed = temp;
+    activity->flags_depth = activity->pass_depth;
+    activity->all_active = false;
+}
+
+static bool is_tile_active(const activity_t* activity, const tiling_t* tiling,
+                           int column, int row) {
+    if (activity->all_active) {
+        return true;
+    }
+    for (int dc = -1; dc <= 1; ++dc) {
+        int c = (column + dc + tiling->columns) % tiling->columns;
+        for (int dr = -1; dr <= 1; ++dr) {
+            int r = (row + dr + tiling->rows) % tiling->rows;
+            if (activity->changed[c * tiling->rows + r]) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool is_tile_changed(const field_t* field, const field_t* next_field,
+                            int from_x, int to_x, int from_w, int to_w) {
+    const uint64_t tail_mask = to_w == field->words - 1 ? get_tail_mask(field) : ~(uint64_t)0;
+    for (int x = from_x; x <= to_x; ++x) {
+        const uint64_t* old_column = get_column(field, x);
+        const uint64_t* new_column = get_column(next_field, x);
+        uint64_t diff = (old_column[to_w] ^ new_column[to_w]) & tail_mask;
+        for (int w = from_w; w < to_w; ++w) {
+            diff |= old_column[w] ^ new_column[w];
+        }
+        if (diff != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* 64 rows of column x starting at row y, wrapping around the torus. */
+static uint64_t load_rows(const field_t* field, int x, int y) {
+    if (y >= 0 && y % kCellsPerWord == 0 && y + kCellsPerWord <= field->height) {
+        return get_column(field, x)[y / kCellsPerWord];
+    }
+
+    uint64_t rows = 0;
+    for (int i = 0; i < kCellsPerWord; ++i) {
+        int row = ((y + i) % field->height + field->height) % field->height;
+        rows |= (uint64_t)get_cell(field, x, row) << i;
+    }
+    return rows;
+}
+
+/* Temporal blocking: the tile is copied into the scratch with a halo of
+ * `depth` columns on each side and one word (64 rows) above and below,
+ * advanced `depth` times while the valid region shrinks by a cell per
+ * generation, and only its center is written back. */
+static void step_tile_deep(const field_t* field, field_t* next_field,
+                           int from_x, int to_x, int from_w, int to_w,
+                           int depth, tile_scratch_t* scratch) {
+    field_t* src = &scratch->buffers[0];
+    field_t* dst = &scratch->buffers[1];
+    const int width = to_x - from_x + 1 + 2 * depth;
+    const int words = to_w - from_w + 3;
+
+    for (int x = 0; x < width; ++x) {
+        int field_x = ((from_x - depth + x) % field->width + field->width) % field->width;
+        uint64_t* column = get_column(src, x);
+        for (int w = 0; w < words; ++w) {
+            column[w] = load_rows(field, field_x, (from_w - 1 + w) * kCellsPerWord);
+        }
+    }
+
+    for (int gen = 1; gen <= depth; ++gen) {
+        step_block(src, dst, gen, width - 1 - gen, 0, words - 1);
+        field_t* temp = src;
+        src = dst;
+        dst = temp;
+    }
+
+    const uint64_t tail_mask = get_tail_mask(field);
+    for (int x = from_x; x <= to_x; ++x) {
+        uint64_t* column = get_column(next_field, x);
+        memcpy(column + from_w, get_column(src, x - from_x + depth) + 1,
+               (to_w - from_w + 1) * sizeof(uint64_t));
+        if (to_w == field->words - 1) {
+            column[to_w] &= tail_mask;
+        }
+    }
+}
+
+void step_tile(const field_t* field, field_t* next_field, const tiling_t* tiling,
+               int column, int row, int depth, tile_scratch_t* scratch,
+               activity_t* activity) {
+    const int from_x = get_tile_from_x(tiling, column);
+    const int to_x = get_tile_to_x(tiling, column);
+    const int from_w = row * tiling->words;
+    const int to_w = row == tiling->rows - 1 ? field->words - 1
+                                             : from_w + tiling->words - 1;
+    if (activity != NULL && !is_tile_active(activity, tiling, column, row)) {
+        activity->next_changed[column * tiling->rows + row] = 0;
+        return;
+    }
+
+    if (depth <= 1) {
+        step_block(field, next_field, from_x, to_x, from_w, to_w);
+    } else {
+        step_tile_deep(field, next_field, from_x, to_x, from_w, to_w,
+                       depth, scratch);
+    }
+
+    if (activity != NULL) {
+        const bool changed = is_tile_changed(field, next_field, from_x, to_x, from_w, to_w);
+        activity->next_changed[column * tiling->rows + row] = changed;
+        if (changed && activity->hashing) {
+            activity->hashes[column * tiling->rows + row] =
+                hash_tile(next_field, tiling, column, row);
+        }
+    }
+}
+
+void step_tiles(const field_t* field, field_t* next_field, const tiling_t* tiling,
+                int from_column, int to_column, int depth, tile_scratch_t* scratch,
+                activity_t* activity) {
+    for (int column = from_column; column <= to_column; ++column) {
+        for (int row = 0; row < tiling->rows; ++row) {
+            step_tile(field, next_field, tiling, column, row, depth, scratch, activity);
+        }
+    }
+}
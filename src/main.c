@@ -1,12 +1,16 @@
 #include <interface.h>
+#include <kernel.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <unistd.h>
 
-#define PTHREAD 1
-#define OPENMP  2
-#define MPI     3
+#define PTHREAD  1
+#define OPENMP   2
+#define MPI      3
+#define HASHLIFE 4
+#define HYBRID   5
 
 #define TRY(call) {                                             \
     const char* err_msg_internal_ = NULL;                       \
@@ -18,12 +22,18 @@
 
 #if BACKEND == OPENMP
 #include <omp.h>
+#include <pthread.h>
 #endif
 
-#if BACKEND == MPI
+#if BACKEND == MPI || BACKEND == HYBRID
 #include <mpi.h>
 #endif
 
+#if BACKEND == HYBRID
+#include <omp.h>
+#include <pthread.h>
+#endif
+
 typedef void(*handler_t)(field_t*, workers_t*);
 
 typedef struct {
@@ -42,7 +52,11 @@ void handle_error(const char* msg, const char* file, int line) {
 const command_t kCommands[] = {
     {"help", "print this text", print_help},
     {"dump", "print current field state", dump_field},
+    {"stats", "print timing and traffic counters", dump_stats},
+    {"save", "write the board to binary snapshot #F", save_field},
+    {"load", "stop and restore the board from snapshot #F", load_field},
     {"run",  "run #N iterations", run},
+    {"run-until-stable", "run up to #N iterations until the board repeats", run_until_stable},
     {"stop", "break calculations", stop},
     {"exit", "close program", NULL},
 };
@@ -52,20 +66,111 @@ const int kCommandsCount = sizeof(kCommands) / sizeof(command_t);
 void print_help(field_t* field, workers_t* workers) {
     printf("# Available commands:\n");
     for (int i = 0; i < kCommandsCount; ++i) {
-        printf("# %-8s - %s\n", kCommands[i].name, kCommands[i].description);
+        printf("# %-16s - %s\n", kCommands[i].name, kCommands[i].description);
     }
+    print_options_help();
 }
 
 void print_title() {
+    if (options.bench != kBenchNone) {
+        return;
+    }
     printf("########################################\n"
            "##       Conway's Game of Life        ##\n"
            "##   (c) Vladimir Ogorodnikov, 2018   ##\n"
            "########################################\n");
     printf("# Version: %s\n", get_version());
+    printf("# Kernel: %s\n", get_kernel_name());
     printf("# To get help, type `help` command\n");
 }
 
+#define kBenchWarmupGenerations 8
+#define kBenchCellUpdates       (1ll << 32)
+#define kBenchMaxGenerations    65536
+#define kBenchLatencySamples    256
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double get_percentile(const double* sorted, int count, int percent) {
+    int index = (count * percent + 99) / 100 - 1;
+    return sorted[index < 0 ? 0 : index];
+}
+
+/* Threads that compute one block and ranks that compute blocks. */
+static void get_parallelism(int* threads, int* ranks) {
+#if BACKEND == OPENMP || BACKEND == HYBRID
+    *threads = omp_get_max_threads();
+#elif BACKEND == PTHREAD
+    *threads = options.threads > 0 ? options.threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    *threads = 1;
+#endif
+#if BACKEND == MPI || BACKEND == HYBRID
+    MPI_Comm_size(MPI_COMM_WORLD, ranks);
+    *ranks -= BACKEND == MPI ? 2 : 0;
+#else
+    *ranks = 1;
+#endif
+}
+
+/* --bench: one long run for the throughput, then single generations for
+ * their latency. The result is a JSON object on one line. */
+void run_bench(workers_t* workers) {
+    const int width = options.board_width > 0 ? options.board_width : kBenchBoardSide;
+    const int height = options.board_height > 0 ? options.board_height : kBenchBoardSide;
+    const long long cells = (long long)width * height;
+    int generations = options.bench_generations;
+    if (generations == 0) {
+        long long gens = kBenchCellUpdates / cells;
+        generations = gens < 16 ? 16 : gens > kBenchMaxGenerations ? kBenchMaxGenerations : gens;
+    }
+
+    run_generations(workers, kBenchWarmupGenerations);
+    finish_generations(workers);
+
+    long long start = get_time_ns();
+    run_generations(workers, generations);
+    finish_generations(workers);
+    const double seconds = (get_time_ns() - start) * 1e-9;
+
+    const int samples = generations < kBenchLatencySamples ? generations : kBenchLatencySamples;
+    double* latencies = malloc(samples * sizeof(double));
+    for (int i = 0; i < samples; ++i) {
+        start = get_time_ns();
+        run_generations(workers, 1);
+        finish_generations(workers);
+        latencies[i] = (get_time_ns() - start) * 1e-3;
+    }
+    qsort(latencies, samples, sizeof(double), compare_doubles);
+
+    static const char* const kWorkloads[] = {"none", "soup", "gliders", "oscillators"};
+    int threads = 0, ranks = 0;
+    get_parallelism(&threads, &ranks);
+    char rule[kMaxRuleLength];
+    format_rule(options.rule, rule);
+    printf("{\"version\": \"%s\", \"kernel\": \"%s\", \"rule\": \"%s\", \"workload\": \"%s\", "
+           "\"density\": %g, \"width\": %d, \"height\": %d, \"threads\": %d, \"ranks\": %d, "
+           "\"generations\": %d, \"seconds\": %.6f, \"cell_updates_per_second\": %.6g, "
+           "\"latency_us\": {\"samples\": %d, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+           "\"max\": %.1f}}\n",
+           get_version(), get_kernel_name(), rule, kWorkloads[options.bench],
+           options.bench == kBenchSoup ? options.density : 0.0, width, height, threads, ranks,
+           generations, seconds, cells * generations / seconds,
+           samples, get_percentile(latencies, samples, 50), get_percentile(latencies, samples, 90),
+           get_percentile(latencies, samples, 99), latencies[samples - 1]);
+    fflush(stdout);
+    free(latencies);
+}
+
 void run_io_loop(field_t* field, workers_t* workers) {
+    if (options.bench != kBenchNone) {
+        run_bench(workers);
+        return;
+    }
+
     bool exit_required = false;
     const int buffer_size = 100;
     char buffer[buffer_size + 1];
@@ -99,6 +204,20 @@ void run_io_loop(field_t* field, workers_t* workers) {
     printf("# Bye!\n");
 }
 
+#if BACKEND == OPENMP || BACKEND == HYBRID
+typedef struct {
+    field_t* field;
+    workers_t* workers;
+} io_thread_args_t;
+
+void* io_thread(void* arg) {
+    io_thread_args_t* args = arg;
+    run_io_loop(args->field, args->workers);
+    stop_emulation(args->workers);
+    return NULL;
+}
+#endif
+
 #if BACKEND == MPI
 int main(int argc, char* argv[]) {
     MPI_Init(NULL, NULL);
@@ -115,13 +234,17 @@ int main(int argc, char* argv[]) {
     int world_rank;
     MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
 
+    TRY(parse_options(argc, argv));
+    TRY(setup_kernel());
+
     if (world_rank == 0) {
         print_title();
         run_io_loop(NULL, NULL);
         stop_emulation(NULL);
     } else if (world_rank == 1) {
         field_t field;
-        TRY(setup_field(argc, argv, &field));
+        TRY(setup_field(options.config_path, &field));
+        setup_rule();
         workers_t workers;
         TRY(setup_workers(&field, &workers));
         run_controller_loop(&field, &workers);
@@ -134,34 +257,69 @@ int main(int argc, char* argv[]) {
     MPI_Finalize();
     return 0;
 }
+#elif BACKEND == HYBRID
+int main(int argc, char* argv[]) {
+    /* Only the main thread of a rank calls MPI. */
+    int provided;
+    MPI_Init_thread(NULL, NULL, MPI_THREAD_FUNNELED, &provided);
+    if (provided < MPI_THREAD_FUNNELED) {
+        printf("MPI library does not support threads, halting!\n");
+        MPI_Finalize();
+        return 1;
+    }
+
+    int world_rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+
+    TRY(parse_options(argc, argv));
+    TRY(setup_kernel());
+
+    /* Rank 0 computes its block on the main thread and reads commands on
+     * another one. */
+    if (world_rank == 0) {
+        print_title();
+        field_t field;
+        TRY(setup_field(options.config_path, &field));
+        setup_rule();
+        workers_t workers;
+        TRY(setup_workers(&field, &workers));
+        pthread_t io_thread_descr;
+        io_thread_args_t io_args = {&field, &workers};
+        pthread_create(&io_thread_descr, NULL, io_thread, &io_args);
+        run_controller_loop(&field, &workers);
+        pthread_join(io_thread_descr, NULL);
+        destroy_workers(&workers);
+        destroy_field(&field);
+    } else {
+        run_controller_loop(NULL, NULL);
+    }
+
+    MPI_Finalize();
+    return 0;
+}
 #else
 int main(int argc, char* argv[]) {
+    TRY(parse_options(argc, argv));
+    TRY(setup_kernel());
     print_title();
     field_t field;
-    TRY(setup_field(argc, argv, &field));
+    TRY(setup_field(options.config_path, &field));
+    setup_rule();
     workers_t workers;
     TRY(setup_workers(&field, &workers));
 
 #if BACKEND == OPENMP
-
-#pragma omp parallel default(shared) num_threads(4)
-{
-#pragma omp sections
-    {
-    #pragma omp section
-    {
-        run_io_loop(&field, &workers);
-        stop_emulation(&workers);
-    }
-
-    #pragma omp section
+    /* The controller stays on the initial thread, so its parallel regions
+     * are not nested and run on the threads that first touched the field. */
+    pthread_t io_thread_descr;
+    io_thread_args_t io_args = {&field, &workers};
+    pthread_create(&io_thread_descr, NULL, io_thread, &io_args);
     run_controller_loop(&field, &workers);
-    }
-}
+    pthread_join(io_thread_descr, NULL);
 
-#elif BACKEND == PTHREAD
+#elif BACKEND == PTHREAD || BACKEND == HASHLIFE
     run_io_loop(&field, &workers);
-#elif BACKEND != MPI
+#elif BACKEND != MPI && BACKEND != HYBRID
 #error "BACKEND is not selected!"
 #endif
     destroy_workers(&workers);
@@ -0,0 +1,289 @@
+#include <interface.h>
+#include <kernel.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Patterns are parsed straight from the mapped file: one pass over the bytes
+ * with no copies, cells are written into the field as they are decoded. */
+typedef struct {
+    const char* data;
+    size_t size;
+    const char* pos;
+    const char* end;
+} reader_t;
+
+static const char* open_reader(reader_t* reader, const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return strerror(errno);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return strerror(errno);
+    }
+    reader->data = NULL;
+    reader->size = st.st_size;
+    if (reader->size > 0) {
+        void* map = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return strerror(errno);
+        }
+        madvise(map, reader->size, MADV_SEQUENTIAL);
+        reader->data = map;
+    }
+    close(fd);
+    reader->pos = reader->data;
+    reader->end = reader->data + reader->size;
+    return NULL;
+}
+
+static void close_reader(reader_t* reader) {
+    if (reader->data != NULL) {
+        munmap((void*)reader->data, reader->size);
+    }
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void skip_line(reader_t* reader) {
+    const char* eol = memchr(reader->pos, '\n', reader->end - reader->pos);
+    reader->pos = eol == NULL ? reader->end : eol + 1;
+}
+
+static void skip_blanks(reader_t* reader) {
+    while (reader->pos < reader->end && (*reader->pos == ' ' || *reader->pos == '\t')) {
+        ++reader->pos;
+    }
+}
+
+static bool read_number(reader_t* reader, int* value) {
+    skip_blanks(reader);
+    if (reader->pos == reader->end || *reader->pos < '0' || *reader->pos > '9') {
+        return false;
+    }
+    int result = 0;
+    while (reader->pos < reader->end && *reader->pos >= '0' && *reader->pos <= '9') {
+        int digit = *reader->pos++ - '0';
+        if (result > (INT_MAX - digit) / 10) {
+            return false;
+        }
+        result = result * 10 + digit;
+    }
+    *value = result;
+    return true;
+}
+
+static bool read_char(reader_t* reader, char c) {
+    skip_blanks(reader);
+    if (reader->pos == reader->end || *reader->pos != c) {
+        return false;
+    }
+    ++reader->pos;
+    return true;
+}
+
+/* `rule = <rule>`, Golly's `:<topology>` suffix left out. The rule is only
+ * taken if --rule is not given. */
+static const char* read_rule(reader_t* reader) {
+    const char* const keyword = "rule";
+    for (const char* c = keyword; *c != '\0'; ++c) {
+        if (!read_char(reader, *c)) {
+            return "Ill-formed RLE header";
+        }
+    }
+    if (!read_char(reader, '=')) {
+        return "Ill-formed RLE header";
+    }
+    skip_blanks(reader);
+    const char* begin = reader->pos;
+    while (reader->pos < reader->end && !is_space(*reader->pos) && *reader->pos != ':') {
+        ++reader->pos;
+    }
+    rule_t rule;
+    if (!parse_rulestring(begin, reader->pos - begin, &rule)) {
+        return "Unknown rule in RLE header";
+    }
+    if (!options.rule_given) {
+        options.rule = rule;
+    }
+    return NULL;
+}
+
+/* `x = <width>, y = <height>[, rule = ...]` after `#` comment lines. */
+static const char* read_rle_header(reader_t* reader, int* width, int* height) {
+    while (reader->pos < reader->end && (*reader->pos == '#' || is_space(*reader->pos))) {
+        if (*reader->pos == '#') {
+            skip_line(reader);
+        } else {
+            ++reader->pos;
+        }
+    }
+    if (!read_char(reader, 'x') || !read_char(reader, '=') || !read_number(reader, width) ||
+        !read_char(reader, ',') ||
+        !read_char(reader, 'y') || !read_char(reader, '=') || !read_number(reader, height)) {
+        return "Ill-formed RLE header";
+    }
+    if (read_char(reader, ',')) {
+        const char* err_msg = read_rule(reader);
+        if (err_msg != NULL) {
+            return err_msg;
+        }
+    }
+    skip_line(reader);
+    return NULL;
+}
+
+/* Runs go along rows, so every cell of a run lands in a column of its own. */
+static const char* decode_rle(reader_t* reader, field_t* field, int offset_x, int offset_y) {
+    int x = 0, y = 0;
+    while (reader->pos < reader->end) {
+        if (is_space(*reader->pos)) {
+            ++reader->pos;
+            continue;
+        }
+        int count = 1;
+        if (*reader->pos >= '0' && *reader->pos <= '9' && !read_number(reader, &count)) {
+            return "Run too long in RLE pattern";
+        }
+        while (reader->pos < reader->end && is_space(*reader->pos)) {
+            ++reader->pos;
+        }
+        if (reader->pos == reader->end) {
+            break;
+        }
+
+        char tag = *reader->pos++;
+        if (tag == '!') {
+            return NULL;
+        } else if (tag == '$') {
+            if (count > INT_MAX - y) {
+                return "Pattern does not fit the board";
+            }
+            y += count;
+            x = 0;
+        } else if (tag == 'b' || tag == '.') {
+            if (count > INT_MAX - x) {
+                return "Pattern does not fit the board";
+            }
+            x += count;
+        } else if ((tag >= 'a' && tag <= 'z') || (tag >= 'A' && tag <= 'Z')) {
+            /* Multi-state tags other than `b` are all taken as alive. */
+            if (y >= field->height - offset_y || count > field->width - offset_x - x) {
+                return "Pattern does not fit the board";
+            }
+            for (int i = 0; i < count; ++i) {
+                set_cell(field, offset_x + x + i, offset_y + y, true);
+            }
+            x += count;
+        } else {
+            return "Ill-formed RLE pattern";
+        }
+    }
+    return NULL;
+}
+
+static bool is_cells_comment(const reader_t* reader) {
+    return reader->pos < reader->end && *reader->pos == '!';
+}
+
+/* Size of a plaintext pattern: the longest row by the number of rows. */
+static void measure_cells(reader_t reader, int* width, int* height) {
+    long long rows = 0, columns = 0;
+    while (reader.pos < reader.end) {
+        const char* line = reader.pos;
+        bool comment = is_cells_comment(&reader);
+        skip_line(&reader);
+        if (!comment) {
+            const char* eol = reader.pos;
+            while (eol > line && is_space(eol[-1])) {
+                --eol;
+            }
+            columns = eol - line > columns ? eol - line : columns;
+            ++rows;
+        }
+    }
+    *width = columns > INT_MAX ? INT_MAX : (int)columns;
+    *height = rows > INT_MAX ? INT_MAX : (int)rows;
+}
+
+static const char* decode_cells(reader_t* reader, field_t* field, int offset_x, int offset_y) {
+    for (int y = offset_y; reader->pos < reader->end; ) {
+        if (is_cells_comment(reader)) {
+            skip_line(reader);
+            continue;
+        }
+        for (int x = offset_x; reader->pos < reader->end && *reader->pos != '\n'; ++x) {
+            char c = *reader->pos++;
+            if (c == 'O' || c == '*') {
+                if (x >= field->width || y >= field->height) {
+                    return "Pattern does not fit the board";
+                }
+                set_cell(field, x, y, true);
+            } else if (c != '.' && !is_space(c)) {
+                return "Ill-formed plaintext pattern";
+            }
+        }
+        reader->pos += reader->pos < reader->end;
+        ++y;
+    }
+    return NULL;
+}
+
+const char* load_pattern(const char* filename, field_t* field) {
+    reader_t reader = {NULL, 0, NULL, NULL};
+    const char* err_msg = open_reader(&reader, filename);
+    if (err_msg != NULL) {
+        return err_msg;
+    }
+
+    while (reader.pos < reader.end && is_space(*reader.pos)) {
+        ++reader.pos;
+    }
+    const bool rle = reader.pos < reader.end && (*reader.pos == '#' || *reader.pos == 'x');
+    int width = 0, height = 0;
+    if (rle) {
+        err_msg = read_rle_header(&reader, &width, &height);
+    } else {
+        reader.pos = reader.data;
+        measure_cells(reader, &width, &height);
+    }
+    if (err_msg != NULL) {
+        close_reader(&reader);
+        return err_msg;
+    }
+
+    long long board_width = options.board_width > 0 ?
+                            options.board_width : (long long)width + options.offset_x;
+    long long board_height = options.board_height > 0 ?
+                             options.board_height : (long long)height + options.offset_y;
+    if (board_width <= 0 || board_height <= 0) {
+        err_msg = "Empty pattern, give the board size with --board";
+    } else if (board_width > INT_MAX || board_height > INT_MAX ||
+               options.offset_x >= board_width || options.offset_y >= board_height) {
+        err_msg = "Pattern does not fit the board";
+    }
+    if (err_msg != NULL) {
+        close_reader(&reader);
+        return err_msg;
+    }
+
+    init_field(field, (int)board_width, (int)board_height);
+    err_msg = rle ? decode_rle(&reader, field, options.offset_x, options.offset_y)
+                  : decode_cells(&reader, field, options.offset_x, options.offset_y);
+    close_reader(&reader);
+    if (err_msg != NULL) {
+        destroy_field(field);
+        return err_msg;
+    }
+    refresh_halo(field);
+    return NULL;
+}
@@ -0,0 +1,98 @@
+#!/bin/bash
+# Runs every tests/*.config for GENERATIONS generations with the command
+# given and compares the board with tests/*.out, which holds what a plain
+# cell-by-cell torus gives. `dump` is polled until the run is over; a
+# backend may count a generation in before its board is complete, so the
+# board is taken once two dumps at GENERATIONS agree. Boards the backend
+# refuses at startup with the given options are skipped.
+#
+# Usage: tests/check.sh [-p] <command> [<arguments>...]
+# -p leaves out boards whose sides are not powers of two.
+
+GENERATIONS=100
+# Dumps polled before a run counts as stuck, 50 ms apart.
+MAX_POLLS=600
+
+shopt -s extglob
+dir=$(dirname "$0")
+# A backend that quit must not take the script with it.
+trap '' PIPE
+pow2_only=false
+if [ "$1" = -p ]; then
+    pow2_only=true
+    shift
+fi
+
+is_pow2() {
+    [ "$1" -gt 0 ] && [ $(($1 & ($1 - 1))) -eq 0 ]
+}
+
+# Leaves the board, row by row, in `board`, or why the backend refused the
+# board in `refused`.
+run_case() {
+    local config=$1 height=$2 line gen= y last=
+    shift 2
+    coproc GAME { "$@" "$config" 2>&1; }
+    local in=${GAME[1]} out=${GAME[0]} pid=$GAME_PID
+    echo "run $GENERATIONS" >&"$in"
+    board=
+    refused=
+    for ((poll = 0; poll < MAX_POLLS; ++poll)); do
+        echo dump 2>/dev/null >&"$in"
+        gen=
+        while read -r -t 10 line <&"$out"; do
+            if [[ $line == *"Current iteration: "* ]]; then
+                gen=${line##*: }
+                break
+            elif [[ $line == *"An error occured in file "* ]]; then
+                refused=${line#*, line +([0-9]): }
+            fi
+        done
+        if [ -z "$gen" ]; then
+            break
+        fi
+        last=$board
+        board=
+        for ((y = 0; y < height; ++y)); do
+            read -r -t 10 line <&"$out" || break
+            line=${line#>> }
+            # Anything else the backend prints goes between the rows.
+            if [[ $line != "#"* ]]; then
+                ((--y))
+                continue
+            fi
+            board+=$line$'\n'
+        done
+        if [ "$gen" -ge "$GENERATIONS" ] && [ "$board" = "$last" ]; then
+            break
+        fi
+        sleep 0.05
+    done
+    echo exit 2>/dev/null >&"$in"
+    exec {in}>&- {out}<&- 2>/dev/null
+    wait "$pid"
+    [ "$gen" = "$GENERATIONS" ]
+}
+
+failed=0
+for config in "$dir"/*.config; do
+    name=$(basename "$config" .config)
+    read -r width height _ < "$config"
+    if $pow2_only && ! { is_pow2 "$width" && is_pow2 "$height"; }; then
+        continue
+    fi
+    if ! run_case "$config" "$height" "$@"; then
+        if [ -n "$refused" ]; then
+            echo "skip $name: $refused"
+        else
+            echo "FAIL $name: no board at generation $GENERATIONS from $*"
+            failed=1
+        fi
+    elif [ "${board%$'\n'}" != "$(< "$dir/$name.out")" ]; then
+        echo "FAIL $name: wrong board at generation $GENERATIONS from $*"
+        failed=1
+    else
+        echo "ok   $name: $*"
+    fi
+done
+exit $failed